@@ -0,0 +1,205 @@
+const std = @import("std");
+const os = std.os;
+const Allocator = std.mem.Allocator;
+const ArrayList = std.ArrayList;
+
+const Ksu = @import("ksu.zig");
+const Utils = @import("utils.zig");
+
+// --- Root backend ---
+//
+// What the engine asks of the root implementation: register (and, on
+// teardown, drop) try-umount paths and report that modules are mounted. The KSU backend
+// talks to the driver; `none` accepts everything and does nothing; `fake`
+// records every call and can add latency per call, so the whole pipeline
+// (and the try-umount volume) can be measured on a plain Linux box.
+pub const Kind = enum { ksu, none, fake };
+
+pub const Backend = struct {
+    kind: Kind,
+    ptr: *anyopaque,
+    vtable: *const VTable,
+
+    pub const VTable = struct {
+        add_unmountable: *const fn (ptr: *anyopaque, path: [:0]const u8) bool,
+        remove_unmountable: *const fn (ptr: *anyopaque, path: [:0]const u8) bool,
+        notify_mounted: *const fn (ptr: *anyopaque) bool,
+    };
+
+    pub fn name(self: Backend) []const u8 {
+        return @tagName(self.kind);
+    }
+
+    /// Registers `paths` as try-umount entries; returns how many succeeded.
+    /// No backend has a multi-path request yet, so this is one call per
+    /// path, but callers always hand over the whole list.
+    pub fn register_unmountable(self: Backend, paths: []const []u8) usize {
+        return self.each_path(paths, self.vtable.add_unmountable);
+    }
+
+    /// Drops try-umount entries; returns how many were removed.
+    pub fn unregister_unmountable(self: Backend, paths: []const []u8) usize {
+        return self.each_path(paths, self.vtable.remove_unmountable);
+    }
+
+    fn each_path(self: Backend, paths: []const []u8, op: *const fn (ptr: *anyopaque, path: [:0]const u8) bool) usize {
+        var buf: [Utils.PATH_MAX]u8 = undefined;
+        var done: usize = 0;
+        for (paths) |p| {
+            if (p.len >= buf.len) continue;
+            @memcpy(buf[0..p.len], p);
+            buf[p.len] = 0;
+            if (op(self.ptr, buf[0..p.len :0])) done += 1;
+        }
+        return done;
+    }
+
+    pub fn notify_mounted(self: Backend) bool {
+        return self.vtable.notify_mounted(self.ptr);
+    }
+};
+
+pub fn parse_kind(s: []const u8) ?Kind {
+    inline for (std.meta.fields(Kind)) |f| {
+        if (std.ascii.eqlIgnoreCase(s, f.name)) return @enumFromInt(f.value);
+    }
+    return null;
+}
+
+// --- KSU ---
+var g_ksu_dummy: u8 = 0;
+
+fn ksu_add(_: *anyopaque, path: [:0]const u8) bool {
+    return Ksu.ksu_send_unmountable(path.ptr) == 0;
+}
+
+fn ksu_remove(_: *anyopaque, path: [:0]const u8) bool {
+    return Ksu.ksu_remove_unmountable(path.ptr) == 0;
+}
+
+fn ksu_notify(_: *anyopaque) bool {
+    return Ksu.ksu_notify_module_mounted() == 0;
+}
+
+const ksu_vtable: Backend.VTable = .{ .add_unmountable = ksu_add, .remove_unmountable = ksu_remove, .notify_mounted = ksu_notify };
+
+// --- None ---
+fn none_add(_: *anyopaque, _: [:0]const u8) bool {
+    return true;
+}
+
+fn none_notify(_: *anyopaque) bool {
+    return true;
+}
+
+const none_vtable: Backend.VTable = .{ .add_unmountable = none_add, .remove_unmountable = none_add, .notify_mounted = none_notify };
+
+// --- Fake ---
+pub const Fake = struct {
+    allocator: Allocator,
+    // added to every call, to model a slow driver
+    latency_us: u64 = 0,
+    // if set, every call is appended here as one line
+    record_path: ?[]const u8 = null,
+
+    mutex: std.Thread.Mutex = .{},
+    registered: ArrayList([]u8),
+    notified: u32 = 0,
+
+    pub fn init(allocator: Allocator) Fake {
+        return .{ .allocator = allocator, .registered = ArrayList([]u8).init(allocator) };
+    }
+
+    pub fn deinit(self: *Fake) void {
+        for (self.registered.items) |p| self.allocator.free(p);
+        self.registered.deinit();
+    }
+
+    pub fn backend(self: *Fake) Backend {
+        return .{ .kind = .fake, .ptr = self, .vtable = &fake_vtable };
+    }
+
+    fn delay(self: *Fake) void {
+        if (self.latency_us > 0) std.time.sleep(self.latency_us * std.time.ns_per_us);
+    }
+
+    fn record(self: *Fake, comptime fmt: []const u8, args: anytype) void {
+        const path = self.record_path orelse return;
+        const file = std.fs.cwd().createFile(path, .{ .truncate = false }) catch return;
+        defer file.close();
+        file.seekFromEnd(0) catch return;
+        file.writer().print(fmt ++ "\n", args) catch {};
+    }
+
+    fn add(ptr: *anyopaque, path: [:0]const u8) bool {
+        const self: *Fake = @ptrCast(@alignCast(ptr));
+        self.delay();
+
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        const copy = self.allocator.dupe(u8, path) catch return false;
+        self.registered.append(copy) catch {
+            self.allocator.free(copy);
+            return false;
+        };
+        Utils.LOGD("fake backend: try-umount {s}", .{path});
+        self.record("umount {s}", .{path});
+        return true;
+    }
+
+    fn remove(ptr: *anyopaque, path: [:0]const u8) bool {
+        const self: *Fake = @ptrCast(@alignCast(ptr));
+        self.delay();
+
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.record("drop-umount {s}", .{path});
+        for (self.registered.items, 0..) |p, i| {
+            if (!std.mem.eql(u8, p, path)) continue;
+            self.allocator.free(self.registered.orderedRemove(i));
+            return true;
+        }
+        // a teardown runs in a fresh process that never saw the
+        // registrations, so an unknown path still counts as dropped
+        return true;
+    }
+
+    fn notify(ptr: *anyopaque) bool {
+        const self: *Fake = @ptrCast(@alignCast(ptr));
+        self.delay();
+
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.notified += 1;
+        Utils.LOGI("fake backend: module-mounted event", .{});
+        self.record("notify module-mounted", .{});
+        return true;
+    }
+
+    pub fn report(self: *Fake) void {
+        Utils.LOGI("fake backend: {d} try-umount registrations, {d} notifications", .{ self.registered.items.len, self.notified });
+    }
+};
+
+const fake_vtable: Backend.VTable = .{ .add_unmountable = Fake.add, .remove_unmountable = Fake.remove, .notify_mounted = Fake.notify };
+
+// --- Active backend ---
+var g_backend: Backend = .{ .kind = .ksu, .ptr = &g_ksu_dummy, .vtable = &ksu_vtable };
+
+pub fn get() Backend {
+    return g_backend;
+}
+
+pub fn set(b: Backend) void {
+    g_backend = b;
+}
+
+/// Selects the stateless ksu or none backend; fake is installed with
+/// set(fake.backend()) by its owner.
+pub fn select(kind: Kind) void {
+    switch (kind) {
+        .ksu => set(.{ .kind = .ksu, .ptr = &g_ksu_dummy, .vtable = &ksu_vtable }),
+        .none => set(.{ .kind = .none, .ptr = &g_ksu_dummy, .vtable = &none_vtable }),
+        .fake => {},
+    }
+}
@@ -0,0 +1,503 @@
+const std = @import("std");
+const os = std.os;
+const Allocator = std.mem.Allocator;
+
+const MagicMount = @import("magic_mount.zig");
+const Utils = @import("utils.zig");
+const Backend = @import("backend.zig");
+const ConfigFile = @import("config.zig");
+const Config = ConfigFile.Config;
+const MountLog = @import("mountlog.zig").MountLog;
+const Status = @import("status.zig");
+const PathIndex = @import("pathindex.zig");
+
+// --- Subcommands ---
+//
+// `mmd <command> [options]` works on the state the last apply left in its
+// temp dir. A bare `mmd`, or one whose first argument is an option, is the
+// boot-time apply. Commands log to stderr only: the apply log (and its
+// rotation) belongs to the boot run.
+pub const Env = struct {
+    allocator: Allocator,
+    cfg: Config,
+    // the apply's temp dir, holding its state files
+    tmp_root: []const u8,
+    // the command's own arguments
+    args: []const []const u8,
+};
+
+const Command = struct {
+    name: []const u8,
+    help: []const u8,
+    run: *const fn (env: *Env) anyerror!u8,
+};
+
+const commands = [_]Command{
+    .{ .name = "umount", .help = "Detach every mount the last run added", .run = cmd_umount },
+    .{ .name = "status", .help = "Print the last run's status snapshot (JSON)", .run = cmd_status },
+    .{ .name = "which", .help = "Show which module serves PATH...", .run = cmd_which },
+    .{ .name = "log", .help = "Print log lines after a byte offset [--since N | --tail N] [--level L] [--module M] [--json]", .run = cmd_log },
+    .{ .name = "tree", .help = "List one level of the mount tree [--path P] [--limit N] [--after NAME] [--json]", .run = cmd_tree },
+};
+
+pub fn find(args: []const [:0]u8) ?*const Command {
+    if (args.len < 2 or args[1].len == 0 or args[1][0] == '-') return null;
+    for (&commands) |*c| {
+        if (std.mem.eql(u8, c.name, args[1])) return c;
+    }
+    return null;
+}
+
+pub fn usage_commands(writer: anytype) void {
+    writer.print("Commands:\n", .{}) catch {};
+    for (commands) |c| writer.print("  {s: <24}  {s}\n", .{ c.name, c.help }) catch {};
+}
+
+/// Runs `cmd` with args[2..]. Options every command understands are taken
+/// out here; everything else is left to the command.
+pub fn run(allocator: Allocator, cmd: *const Command, args: []const [:0]u8) !u8 {
+    Utils.logSetFile(null);
+
+    var config_path: []const u8 = ConfigFile.DEFAULT_PATH;
+    var tmp_dir: ?[]const u8 = null;
+    var backend: ?Backend.Kind = null;
+    var verbose = false;
+
+    var rest = std.ArrayList([]const u8).init(allocator);
+    defer rest.deinit();
+
+    var i: usize = 2;
+    while (i < args.len) : (i += 1) {
+        const arg = args[i];
+        const has_value = i + 1 < args.len;
+        if ((std.mem.eql(u8, arg, "-c") or std.mem.eql(u8, arg, "--config")) and has_value) {
+            i += 1;
+            config_path = args[i];
+        } else if ((std.mem.eql(u8, arg, "-t") or std.mem.eql(u8, arg, "--temp-dir")) and has_value) {
+            i += 1;
+            tmp_dir = args[i];
+        } else if (std.mem.eql(u8, arg, "--backend") and has_value) {
+            i += 1;
+            backend = Backend.parse_kind(args[i]) orelse {
+                std.debug.print("Error: Unknown backend: {s}\n", .{args[i]});
+                return 1;
+            };
+        } else if (std.mem.eql(u8, arg, "-v") or std.mem.eql(u8, arg, "--verbose")) {
+            verbose = true;
+        } else {
+            try rest.append(arg);
+        }
+    }
+
+    var env: Env = .{ .allocator = allocator, .cfg = .{}, .tmp_root = undefined, .args = rest.items };
+    try ConfigFile.load_config_file(allocator, config_path, &env.cfg);
+    if (verbose or env.cfg.debug) Utils.logSetLevel(.debug);
+
+    // fake keeps no state across processes, so a command only ever talks
+    // to ksu or none
+    const kind = backend orelse env.cfg.backend;
+    Backend.select(if (kind == .fake) .none else kind);
+
+    var auto_tmp: [Utils.PATH_MAX]u8 = undefined;
+    env.tmp_root = tmp_dir orelse env.cfg.temp_dir orelse find_state_dir(&auto_tmp);
+
+    return cmd.run(&env);
+}
+
+// The apply picked its temp dir among the auto candidates at boot; the one
+// holding a record file is it.
+pub fn find_state_dir(buf: *[Utils.PATH_MAX]u8) []const u8 {
+    const candidates = [_][]const u8{ "/mnt/vendor/.magic_mount", "/mnt/.magic_mount", "/debug_ramdisk/.magic_mount", Utils.DEFAULT_TEMP_DIR };
+    for (candidates) |cand| {
+        var pb = Utils.PathBuf.init(cand) catch continue;
+        _ = pb.push(MagicMount.RECORDS_FILE) catch continue;
+        if (!Utils.path_exists(pb.slice())) continue;
+        @memcpy(buf[0..cand.len], cand);
+        return buf[0..cand.len];
+    }
+    return Utils.select_auto_tempdir(buf);
+}
+
+fn state_path(env: *const Env, buf: *[Utils.PATH_MAX]u8, name: []const u8) ![]const u8 {
+    return Utils.path_join(env.allocator, buf, env.tmp_root, name);
+}
+
+// --- umount ---
+//
+// Undo the last run without a reboot: detach what it recorded, deepest
+// first, and drop the try-umount entries of what was detached. Mounts that
+// have since been covered or replaced by something else are left alone and
+// stay in the record file, so a later umount can still take them down.
+fn cmd_umount(env: *Env) !u8 {
+    if (env.args.len > 0) {
+        std.debug.print("Error: umount takes no arguments\n", .{});
+        return 1;
+    }
+    try Utils.root_check();
+
+    var buf: [Utils.PATH_MAX]u8 = undefined;
+    const records_path = try state_path(env, &buf, MagicMount.RECORDS_FILE);
+
+    const started = std.time.nanoTimestamp();
+    var log = MountLog.load(env.allocator, records_path) catch |err| {
+        if (err == error.FileNotFound) {
+            Utils.LOGI("nothing to undo: no {s}", .{records_path});
+            return 0;
+        }
+        Utils.LOGE("read {s}: {s}", .{ records_path, @errorName(err) });
+        return 1;
+    };
+    defer log.deinit();
+
+    var mark_buf: [16]u8 = undefined;
+    const mark = MagicMount.run_mark(&mark_buf, log.run_id);
+    const detached = MagicMount.detach_records(env.allocator, log.records.items, mark) catch |err| {
+        Utils.LOGE("detach: {s}", .{@errorName(err)});
+        return 1;
+    };
+    const dropped = if (env.cfg.umount) MagicMount.unregister_units(env.allocator, &log, log.records.items[0..detached]) else 0;
+
+    if (detached == log.records.items.len) {
+        os.unlink(records_path) catch |err| {
+            Utils.LOGW("remove {s}: {s}", .{ records_path, @errorName(err) });
+        };
+    } else {
+        keep_remaining(env.allocator, &log, detached, records_path) catch |err| {
+            Utils.LOGW("write {s}: {s}", .{ records_path, @errorName(err) });
+        };
+    }
+
+    const took_us = @divTrunc(std.time.nanoTimestamp() - started, std.time.ns_per_us);
+    Utils.LOGI("umount: detached {d} of {d} mounts, dropped {d} try-umount paths in {d} us", .{
+        detached, log.records.items.len, dropped, took_us,
+    });
+    return if (detached == log.records.items.len) 0 else 1;
+}
+
+// Rewrite the record file with the mounts detach_records left in place
+// (records[detached..]) and their units.
+fn keep_remaining(allocator: Allocator, log: *const MountLog, detached: usize, records_path: []const u8) !void {
+    var rest = MountLog.init(allocator);
+    defer rest.deinit();
+    // no longer the whole module set: a rerun must not count it as applied
+    rest.fingerprint = 0;
+    rest.run_id = log.run_id;
+    for (log.records.items[detached..]) |r| {
+        try rest.add(r.path, r.source, r.kind, r.module, r.partition);
+        if (log.find_unit(r.path)) |u| try rest.add_unit(u.path, u.digest);
+    }
+    rest.sort();
+    try rest.save(records_path, false);
+}
+
+// --- status ---
+//
+// The snapshot is written whole by every run, so this is one read and one
+// write; no root needed, the WebUI polls it.
+fn cmd_status(env: *Env) !u8 {
+    if (env.args.len > 0) {
+        std.debug.print("Error: status takes no arguments\n", .{});
+        return 1;
+    }
+
+    var buf: [Utils.PATH_MAX]u8 = undefined;
+    const path = try state_path(env, &buf, Status.STATUS_FILE);
+    const data = std.fs.cwd().readFileAlloc(env.allocator, path, 64 * 1024 * 1024) catch |err| {
+        Utils.LOGE("read {s}: {s}", .{ path, @errorName(err) });
+        return 1;
+    };
+    defer env.allocator.free(data);
+
+    try std.io.getStdOut().writeAll(data);
+    return 0;
+}
+
+// --- which ---
+//
+// Looks each path up in the path index the last run left: the module
+// entry for the path itself or, failing that, the closest directory above
+// it that a module rebuilt (a real file mirrored into a module's tmpfs dir
+// is served by that dir). Exits 1 if any path is not overridden.
+fn cmd_which(env: *Env) !u8 {
+    if (env.args.len == 0) {
+        std.debug.print("Error: which needs at least one PATH\n", .{});
+        return 1;
+    }
+
+    var buf: [Utils.PATH_MAX]u8 = undefined;
+    const path = try state_path(env, &buf, PathIndex.INDEX_FILE);
+    var index = PathIndex.Index.open(path) catch |err| {
+        Utils.LOGE("read {s}: {s}", .{ path, @errorName(err) });
+        return 1;
+    };
+    defer index.close();
+
+    var bw = std.io.bufferedWriter(std.io.getStdOut().writer());
+    const w = bw.writer();
+    var rc: u8 = 0;
+    for (env.args) |arg| {
+        const p = if (arg.len > 1) std.mem.trimRight(u8, arg, "/") else arg;
+        if (p.len == 0 or p[0] != '/') {
+            try w.print("{s}: not an absolute path\n", .{arg});
+            rc = 1;
+            continue;
+        }
+        const it = index.covering(p) orelse {
+            try w.print("{s}: not overridden\n", .{p});
+            rc = 1;
+            continue;
+        };
+        const at = index.path_of(it);
+        const module = index.module_of(it) orelse "-";
+        if (at.len == p.len) {
+            try w.print("{s}: {s} from {s}, {s}\n", .{ p, @tagName(it.kind), module, @tagName(it.strategy) });
+        } else {
+            try w.print("{s}: inside {s} ({s} from {s}, {s})\n", .{ p, at, @tagName(it.kind), module, @tagName(it.strategy) });
+        }
+    }
+    try bw.flush();
+    return rc;
+}
+
+// --- tree ---
+//
+// One directory level of the merged tree per call, from the path index:
+// each child with its module and strategy if a module provides it, and
+// how many entries lie below. Pages are chained with --after, so a client
+// never loads more than it shows.
+const TREE_DEFAULT_LIMIT = 200;
+const TREE_MAX_LIMIT = 5000;
+
+fn cmd_tree(env: *Env) !u8 {
+    var dir: []const u8 = "/";
+    var after: ?[]const u8 = null;
+    var limit: usize = TREE_DEFAULT_LIMIT;
+    var json = false;
+
+    var i: usize = 0;
+    while (i < env.args.len) : (i += 1) {
+        const arg = env.args[i];
+        const has_value = i + 1 < env.args.len;
+        if (std.mem.eql(u8, arg, "--json")) {
+            json = true;
+        } else if (std.mem.eql(u8, arg, "--path") and has_value) {
+            i += 1;
+            dir = env.args[i];
+        } else if (std.mem.eql(u8, arg, "--after") and has_value) {
+            i += 1;
+            after = env.args[i];
+        } else if (std.mem.eql(u8, arg, "--limit") and has_value) {
+            i += 1;
+            limit = std.fmt.parseInt(usize, env.args[i], 10) catch {
+                std.debug.print("Error: Invalid value for --limit: {s}\n", .{env.args[i]});
+                return 1;
+            };
+            limit = std.math.clamp(limit, 1, TREE_MAX_LIMIT);
+        } else {
+            std.debug.print("Error: Unknown argument: {s}\n", .{arg});
+            return 1;
+        }
+    }
+    if (dir.len > 1) dir = std.mem.trimRight(u8, dir, "/");
+    if (dir.len == 0 or dir[0] != '/') {
+        std.debug.print("Error: --path must be absolute\n", .{});
+        return 1;
+    }
+
+    var buf: [Utils.PATH_MAX]u8 = undefined;
+    const path = try state_path(env, &buf, PathIndex.INDEX_FILE);
+    var index = PathIndex.Index.open(path) catch |err| {
+        Utils.LOGE("read {s}: {s}", .{ path, @errorName(err) });
+        return 1;
+    };
+    defer index.close();
+
+    const out = try env.allocator.alloc(PathIndex.Child, limit);
+    defer env.allocator.free(out);
+    const listing = try index.children(dir, after, out);
+    const children = out[0..listing.count];
+
+    var bw = std.io.bufferedWriter(std.io.getStdOut().writer());
+    const w = bw.writer();
+    if (json) {
+        try w.writeAll("{\"path\":");
+        try Status.write_json_string(w, dir);
+        try w.writeAll(",\"entries\":[");
+        for (children, 0..) |c, n| {
+            if (n > 0) try w.writeByte(',');
+            try w.writeAll("{\"name\":");
+            try Status.write_json_string(w, c.name);
+            if (c.item) |it| {
+                try w.print(",\"kind\":\"{s}\",\"strategy\":\"{s}\",\"module\":", .{ @tagName(it.kind), @tagName(it.strategy) });
+                if (index.module_of(it)) |m| try Status.write_json_string(w, m) else try w.writeAll("null");
+            } else {
+                try w.writeAll(",\"kind\":\"dir\",\"strategy\":null,\"module\":null");
+            }
+            try w.print(",\"entries\":{d}}}", .{c.entries});
+        }
+        try w.writeAll("],\"next\":");
+        if (listing.more and children.len > 0) {
+            try Status.write_json_string(w, children[children.len - 1].name);
+        } else {
+            try w.writeAll("null");
+        }
+        try w.writeAll("}\n");
+    } else {
+        for (children) |c| {
+            if (c.item) |it| {
+                try w.print("{s}\t{s}\t{s}\t{s}\t{d}\n", .{ c.name, @tagName(it.kind), index.module_of(it) orelse "-", @tagName(it.strategy), c.entries });
+            } else {
+                try w.print("{s}\tdir\t-\t-\t{d}\n", .{ c.name, c.entries });
+            }
+        }
+        if (listing.more and children.len > 0) try w.print("... more after {s}\n", .{children[children.len - 1].name});
+    }
+    try bw.flush();
+    return 0;
+}
+
+// --- log ---
+//
+// Incremental reads of the apply log for pollers: lines after a byte
+// offset (or the last N bytes), filtered by level and module, and the
+// offset to continue from. Only whole lines are returned, so the next
+// call picks up exactly where this one stopped, and one call never reads
+// more than --max-bytes of the file. A file shorter than the offset has
+// been rotated; reading starts over from its beginning.
+const LOG_DEFAULT_MAX_BYTES = 64 * 1024;
+const LOG_MAX_MAX_BYTES = 4 * 1024 * 1024;
+
+const LogLevel = Utils.LogLevel;
+
+fn cmd_log(env: *Env) !u8 {
+    var log_path: ?[]const u8 = env.cfg.log_file;
+    var since: ?u64 = null;
+    var tail: ?u64 = null;
+    var min_level: LogLevel = .debug;
+    var module: ?[]const u8 = null;
+    var max_bytes: usize = LOG_DEFAULT_MAX_BYTES;
+    var json = false;
+
+    var i: usize = 0;
+    while (i < env.args.len) : (i += 1) {
+        const arg = env.args[i];
+        const has_value = i + 1 < env.args.len;
+        if (std.mem.eql(u8, arg, "--json")) {
+            json = true;
+            continue;
+        }
+        if (!has_value) {
+            std.debug.print("Error: Unknown argument: {s}\n", .{arg});
+            return 1;
+        }
+        i += 1;
+        const val = env.args[i];
+        if (std.mem.eql(u8, arg, "--file")) {
+            log_path = val;
+        } else if (std.mem.eql(u8, arg, "--since")) {
+            since = std.fmt.parseInt(u64, val, 10) catch return bad_value(arg, val);
+        } else if (std.mem.eql(u8, arg, "--tail")) {
+            tail = std.fmt.parseInt(u64, val, 10) catch return bad_value(arg, val);
+        } else if (std.mem.eql(u8, arg, "--max-bytes")) {
+            max_bytes = std.fmt.parseInt(usize, val, 10) catch return bad_value(arg, val);
+            max_bytes = std.math.clamp(max_bytes, 1, LOG_MAX_MAX_BYTES);
+        } else if (std.mem.eql(u8, arg, "--level")) {
+            min_level = parse_level(val) orelse return bad_value(arg, val);
+        } else if (std.mem.eql(u8, arg, "--module")) {
+            module = val;
+        } else {
+            std.debug.print("Error: Unknown argument: {s}\n", .{arg});
+            return 1;
+        }
+    }
+
+    const path = log_path orelse {
+        Utils.LOGE("no log file: set log_file in the config or pass --file", .{});
+        return 1;
+    };
+    const file = std.fs.cwd().openFile(path, .{}) catch |err| {
+        Utils.LOGE("open {s}: {s}", .{ path, @errorName(err) });
+        return 1;
+    };
+    defer file.close();
+
+    const size = try file.getEndPos();
+    var start: u64 = since orelse if (tail) |t| size -| t else 0;
+    var rotated = false;
+    if (start > size) {
+        start = 0;
+        rotated = true;
+    }
+
+    const buf = try env.allocator.alloc(u8, @min(max_bytes, size - start));
+    defer env.allocator.free(buf);
+    const n = try file.preadAll(buf, start);
+    var chunk = buf[0..n];
+
+    // a tail starts mid-line: skip to the next whole one
+    if (since == null and tail != null and start > 0) {
+        const nl = std.mem.indexOfScalar(u8, chunk, '\n') orelse chunk.len;
+        chunk = chunk[@min(nl + 1, chunk.len)..];
+        start += n - chunk.len;
+    }
+    // ... and stop at the last whole line, unless one line fills the read;
+    // a short read without one ended mid-line while it was being written
+    if (std.mem.lastIndexOfScalar(u8, chunk, '\n')) |nl| {
+        chunk = chunk[0 .. nl + 1];
+    } else if (n < max_bytes) {
+        chunk = chunk[0..0];
+    }
+    const next = start + chunk.len;
+
+    var bw = std.io.bufferedWriter(std.io.getStdOut().writer());
+    const w = bw.writer();
+    if (json) try w.print("{{\"offset\":{d},\"next\":{d},\"size\":{d},\"rotated\":{},\"lines\":[", .{ start, next, size, rotated });
+
+    var level: LogLevel = .info;
+    var first = true;
+    var lines = std.mem.splitScalar(u8, chunk, '\n');
+    while (lines.next()) |line| {
+        if (line.len == 0) continue;
+        // untagged lines (a multi-line message) belong to the one before
+        if (line_level(line)) |lv| level = lv;
+        if (@intFromEnum(level) < @intFromEnum(min_level)) continue;
+        if (module) |m| {
+            if (std.mem.indexOf(u8, line, m) == null) continue;
+        }
+        if (json) {
+            if (!first) try w.writeByte(',');
+            try Status.write_json_string(w, line);
+        } else {
+            try w.print("{s}\n", .{line});
+        }
+        first = false;
+    }
+    if (json) try w.writeAll("]}\n");
+    try bw.flush();
+    return 0;
+}
+
+fn bad_value(arg: []const u8, val: []const u8) u8 {
+    std.debug.print("Error: Invalid value for {s}: {s}\n", .{ arg, val });
+    return 1;
+}
+
+fn parse_level(s: []const u8) ?LogLevel {
+    inline for (std.meta.fields(LogLevel)) |f| {
+        if (std.ascii.eqlIgnoreCase(s, f.name)) return @field(LogLevel, f.name);
+    }
+    if (std.ascii.eqlIgnoreCase(s, "warning")) return .warn;
+    return null;
+}
+
+// "[WARN] file.zig:12: ..." as written by Utils.logWrite
+fn line_level(line: []const u8) ?LogLevel {
+    if (line.len < 2 or line[0] != '[') return null;
+    const end = std.mem.indexOfScalar(u8, line, ']') orelse return null;
+    const tag = line[1..end];
+    if (std.mem.eql(u8, tag, "ERROR")) return .@"error";
+    if (std.mem.eql(u8, tag, "WARN")) return .warn;
+    if (std.mem.eql(u8, tag, "INFO")) return .info;
+    if (std.mem.eql(u8, tag, "DEBUG")) return .debug;
+    return null;
+}
@@ -0,0 +1,125 @@
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+const Utils = @import("utils.zig");
+const Backend = @import("backend.zig");
+
+pub const DEFAULT_PATH = "/data/adb/magic_mount/mm.conf";
+
+// --- mm.conf ---
+//
+// key = value lines, '#' comments. Shared by the boot-time apply and the
+// subcommands; fields left null fall back to the built-in defaults.
+pub const Config = struct {
+    module_dir: ?[]const u8 = null,
+    temp_dir: ?[]const u8 = null,
+    mount_source: ?[]const u8 = null,
+    log_file: ?[]const u8 = null,
+    partitions: ?[]const u8 = null,
+    debug: bool = false,
+    umount: bool = true,
+    threads: ?i32 = null,
+    inline_copy_kb: ?i32 = null,
+    max_mounts: ?i32 = null,
+    verify: bool = false,
+    prefetch: bool = true,
+    priority: ?[]const u8 = null,
+    critical: ?[]const u8 = null,
+    early_notify: bool = false,
+    notify: bool = true,
+    backend: Backend.Kind = .ksu,
+    fake_latency_us: u64 = 0,
+    fake_record: ?[]const u8 = null,
+};
+
+pub fn load_config_file(allocator: Allocator, path: []const u8, cfg: *Config) !void {
+    var file = std.fs.cwd().openFile(path, .{}) catch |err| {
+        if (err != error.FileNotFound) {
+            Utils.LOGW("config file {s}: {s}", .{ path, @errorName(err) });
+        }
+        return;
+    };
+    defer file.close();
+
+    Utils.LOGI("Loading config file: {s}", .{path});
+
+    var buf: [1024]u8 = undefined;
+    var line_num: usize = 0;
+
+    var stream = std.io.bufferedReader(file.reader());
+    var reader = stream.reader();
+
+    while (try reader.readUntilDelimiterOrEof(&buf, '\n')) |line| {
+        line_num += 1;
+
+        var trimmed = Utils.str_trim(line);
+        if (trimmed.len == 0 or trimmed[0] == '#') continue;
+
+        const eq_index = std.mem.indexOfScalar(u8, trimmed, '=') orelse {
+            Utils.LOGW("config:{d}: invalid line (no '=')", .{line_num});
+            continue;
+        };
+
+        const key = Utils.str_trim(trimmed[0..eq_index]);
+        const val = Utils.str_trim(trimmed[eq_index + 1 ..]);
+
+        if (key.len == 0 or val.len == 0) continue;
+
+        if (std.ascii.eqlIgnoreCase(key, "module_dir")) {
+            cfg.module_dir = try allocator.dupe(u8, val);
+        } else if (std.ascii.eqlIgnoreCase(key, "temp_dir")) {
+            cfg.temp_dir = try allocator.dupe(u8, val);
+        } else if (std.ascii.eqlIgnoreCase(key, "mount_source")) {
+            cfg.mount_source = try allocator.dupe(u8, val);
+        } else if (std.ascii.eqlIgnoreCase(key, "log_file")) {
+            cfg.log_file = try allocator.dupe(u8, val);
+        } else if (std.ascii.eqlIgnoreCase(key, "debug")) {
+            cfg.debug = Utils.str_is_true(val);
+        } else if (std.ascii.eqlIgnoreCase(key, "umount")) {
+            cfg.umount = Utils.str_is_true(val);
+        } else if (std.ascii.eqlIgnoreCase(key, "inline_copy_kb")) {
+            cfg.inline_copy_kb = std.fmt.parseInt(i32, val, 10) catch blk: {
+                Utils.LOGW("config:{d}: invalid inline_copy_kb '{s}'", .{ line_num, val });
+                break :blk null;
+            };
+        } else if (std.ascii.eqlIgnoreCase(key, "verify")) {
+            cfg.verify = Utils.str_is_true(val);
+        } else if (std.ascii.eqlIgnoreCase(key, "max_mounts")) {
+            cfg.max_mounts = std.fmt.parseInt(i32, val, 10) catch blk: {
+                Utils.LOGW("config:{d}: invalid max_mounts '{s}'", .{ line_num, val });
+                break :blk null;
+            };
+        } else if (std.ascii.eqlIgnoreCase(key, "threads")) {
+            cfg.threads = std.fmt.parseInt(i32, val, 10) catch blk: {
+                Utils.LOGW("config:{d}: invalid threads '{s}'", .{ line_num, val });
+                break :blk null;
+            };
+        } else if (std.ascii.eqlIgnoreCase(key, "priority")) {
+            cfg.priority = try allocator.dupe(u8, val);
+        } else if (std.ascii.eqlIgnoreCase(key, "critical")) {
+            cfg.critical = try allocator.dupe(u8, val);
+        } else if (std.ascii.eqlIgnoreCase(key, "early_notify")) {
+            cfg.early_notify = Utils.str_is_true(val);
+        } else if (std.ascii.eqlIgnoreCase(key, "backend")) {
+            cfg.backend = Backend.parse_kind(val) orelse blk: {
+                Utils.LOGW("config:{d}: unknown backend '{s}'", .{ line_num, val });
+                break :blk cfg.backend;
+            };
+        } else if (std.ascii.eqlIgnoreCase(key, "fake_latency_us")) {
+            cfg.fake_latency_us = std.fmt.parseInt(u64, val, 10) catch blk: {
+                Utils.LOGW("config:{d}: invalid fake_latency_us '{s}'", .{ line_num, val });
+                break :blk 0;
+            };
+        } else if (std.ascii.eqlIgnoreCase(key, "fake_record")) {
+            cfg.fake_record = try allocator.dupe(u8, val);
+        } else if (std.ascii.eqlIgnoreCase(key, "notify")) {
+            cfg.notify = Utils.str_is_true(val);
+        } else if (std.ascii.eqlIgnoreCase(key, "prefetch")) {
+            cfg.prefetch = Utils.str_is_true(val);
+        } else if (std.ascii.eqlIgnoreCase(key, "partitions")) {
+            cfg.partitions = try allocator.dupe(u8, val);
+        } else {
+            Utils.LOGW("config:{d}: unknown key '{s}'", .{ line_num, key });
+        }
+    }
+}
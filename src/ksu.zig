@@ -12,6 +12,13 @@ const KSU_INSTALL_MAGIC2: u64 = 0xCAFEBABE;
 
 const KSU_IOCTL_ADD_TRY_UMOUNT = linux._IO(_IOC_WRITE, 'K', 18, 0);
 
+const KSU_IOCTL_REPORT_EVENT = linux._IO(_IOC_WRITE, 'K', 3, 0);
+const EVENT_MODULE_MOUNTED: u32 = 3;
+
+const KsuReportEventCmd = extern struct {
+    event: u32,
+};
+
 const KsuAddTryUmountCmd = extern struct {
     arg: u64,   // pointer to const char*
     flags: u32,
@@ -73,24 +80,56 @@ fn ksuGrabFd() i32 {
     return g_driver_fd.load(.seq_cst);
 }
 
-// --- Main exported function ---
-pub export fn ksu_send_unmountable(mntpoint: [*:0]const u8) c_int {
+// try-umount list operations (KsuAddTryUmountCmd.mode)
+const TRY_UMOUNT_ADD: u8 = 1;
+const TRY_UMOUNT_DEL: u8 = 2;
+
+fn ksuTryUmount(mntpoint: [*:0]const u8, mode: u8) c_int {
     const fd = ksuGrabFd();
     if (fd < 0) return -1;
 
     var cmd: KsuAddTryUmountCmd = .{
         .arg = @ptrToInt(mntpoint),
         .flags = 0x2,
-        .mode = 1,
+        .mode = mode,
         .pad = [_]u8{0} ** 3,
     };
 
     const rc = ioctl(fd, KSU_IOCTL_ADD_TRY_UMOUNT, @ptrToInt(&cmd));
     if (rc != 0) {
         const errno = @intCast(os.errno(rc));
-        LOG(LOG_ERROR, "ioctl KSU_IOCTL_ADD_TRY_UMOUNT failed: {}", .{@errorName(@as(anyerror, @enumFromInt(errno)))});
+        LOG(LOG_ERROR, "ioctl KSU_IOCTL_ADD_TRY_UMOUNT (mode {}) failed: {}", .{ mode, @errorName(@as(anyerror, @enumFromInt(errno))) });
+        return -1;
+    }
+
+    return 0;
+}
+
+// --- Main exported function ---
+pub export fn ksu_send_unmountable(mntpoint: [*:0]const u8) c_int {
+    return ksuTryUmount(mntpoint, TRY_UMOUNT_ADD);
+}
+
+pub export fn ksu_remove_unmountable(mntpoint: [*:0]const u8) c_int {
+    return ksuTryUmount(mntpoint, TRY_UMOUNT_DEL);
+}
+
+// --- Boot event notification ---
+// Same event `ksud kernel notify-module-mounted` reports, sent through the
+// driver fd we already hold instead of spawning ksud.
+pub export fn ksu_notify_module_mounted() c_int {
+    const fd = ksuGrabFd();
+    if (fd < 0) return -1;
+
+    var cmd: KsuReportEventCmd = .{ .event = EVENT_MODULE_MOUNTED };
+
+    const rc = ioctl(fd, KSU_IOCTL_REPORT_EVENT, @ptrToInt(&cmd));
+    if (rc != 0) {
+        const errno = @intCast(os.errno(rc));
+        LOG(LOG_ERROR, "ioctl KSU_IOCTL_REPORT_EVENT failed: {}", .{@errorName(@as(anyerror, @enumFromInt(errno)))});
         return -1;
     }
 
+    LOG(LOG_INFO, "reported module-mounted event", .{});
     return 0;
 }
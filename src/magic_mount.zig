@@ -6,9 +6,24 @@ const ArrayList = std.ArrayList;
 const ArrayListUnmanaged = std.ArrayListUnmanaged;
 
 // --- External dependencies (assumed to be defined elsewhere in Zig) ---
-const Ksu = @import("ksu.zig");
+const Backend = @import("backend.zig");
 const ModuleTree = @import("module_tree.zig");
 const Utils = @import("utils.zig");
+const WorkDir = @import("workdir.zig").WorkDir;
+const RealDir = @import("realdir.zig").RealDir;
+const RealEntry = @import("realdir.zig").Entry;
+const chain_is_plain = @import("realdir.zig").chain_is_plain;
+const MountLog = @import("mountlog.zig").MountLog;
+const MountKind = @import("mountlog.zig").Kind;
+const MountRecord = @import("mountlog.zig").Record;
+const MountUnit = @import("mountlog.zig").Unit;
+const MountSpan = @import("mountlog.zig").Span;
+const MountLogMark = @import("mountlog.zig").Mark;
+const Tally = @import("mountlog.zig").Tally;
+const Verify = @import("verify.zig");
+const MountInfo = @import("mountinfo.zig").MountInfo;
+const PathIndex = @import("pathindex.zig");
+const Report = @import("report.zig");
 
 extern fn logWrite(level: i32, file: [*:0]const u8, line: c_int, fmt: [*:0]const u8, ...) void;
 
@@ -47,6 +62,25 @@ pub const MountStats = extern struct {
     nodes_skipped: i32,
     nodes_whiteout: i32,
     nodes_fail: i32,
+    selcon_relabels: i32,
+    selcon_skipped: i32,
+    umount_candidates: i32,
+    umount_registered: i32,
+    inline_files: i32,
+    // 64-bit: a few thousand inlined files of up to 1 MiB overflow an i32
+    inline_bytes: i64,
+    tmpfs_used_kb: i32,
+    tmpfs_inodes: i32,
+    mounts_added: i32,
+    verify_checked: i32,
+    verify_failed: i32,
+    // 1 if the previous run's mounts were found in place and kept
+    already_applied: i32,
+    // the plan: partitions streamed in, subtrees they were cut into, and
+    // the worker threads that applied them
+    partitions: i32,
+    subtrees: i32,
+    threads_used: i32,
 };
 
 pub const MagicMount = extern struct {
@@ -62,6 +96,45 @@ pub const MagicMount = extern struct {
     extra_parts_count: i32,
 
     enable_unmountable: bool,
+
+    // apply worker threads, 0 = auto
+    apply_threads: i32,
+
+    // module files up to this size (KiB) are copied into a tmpfs dir
+    // instead of bind-mounted, 0 = never
+    inline_copy_kb: i32,
+
+    // mounts a run may add before it switches to mount-minimising, 0 = no limit
+    max_mounts: i32,
+
+    // partition apply order, and the boot-critical partitions that make up
+    // the first stage of a two-stage run
+    partition_order: [*] [*:0]u8,
+    partition_order_count: i32,
+    critical_parts: [*] [*:0]u8,
+    critical_parts_count: i32,
+
+    // which partitions this run applies, see ApplyStage
+    apply_stage: i32,
+
+    // re-check every mount against mountinfo once the apply is done
+    verify: bool,
+
+    // set by magic_mount(): fingerprint of the module set being applied,
+    // and the id this run's tmpfs dirs are marked with
+    fingerprint: u64,
+    run_id: u64,
+
+    // diff against the previous run's units instead of replacing it
+    incremental: bool,
+};
+
+pub const ApplyStage = enum(i32) {
+    all = 0,
+    // only the critical partitions, mounted before the notification
+    critical = 1,
+    // everything else, finished in the background
+    deferred = 2,
 };
 
 // --- Initialization ---
@@ -71,6 +144,10 @@ pub fn magic_mount_init(ctx: *MagicMount) void {
     ctx.module_dir = DEFAULT_MODULE_DIR;
     ctx.mount_source = DEFAULT_MOUNT_SOURCE;
     ctx.enable_unmountable = true;
+    ctx.apply_threads = 0;
+    ctx.inline_copy_kb = 0;
+    ctx.max_mounts = 0;
+    ctx.apply_stage = @intFromEnum(ApplyStage.all);
 }
 
 // --- Cleanup ---
@@ -79,139 +156,357 @@ pub fn magic_mount_cleanup(ctx: *MagicMount) void {
     ModuleTree.module_tree_cleanup(ctx);
 }
 
-// --- Forward declarations ---
-fn mm_clone_symlink(allocator: Allocator, src: [*:0]const u8, dst: [*:0]const u8) !void;
-fn mm_mirror_entry(ctx: *MagicMount, allocator: Allocator, path: [*:0]const u8, work: [*:0]const u8, name: [*:0]const u8) !void;
-fn mm_apply_node_recursive(ctx: *MagicMount, allocator: Allocator, base: [*:0]const u8, wbase: [*:0]const u8, node: *ModuleTree.Node, has_tmpfs: bool) !void;
-fn mm_check_need_tmpfs(node: *ModuleTree.Node, path: [*:0]const u8) bool;
-fn mm_setup_dir_tmpfs(path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTree.Node) !void;
-fn mm_process_dir_children(ctx: *MagicMount, allocator: Allocator, path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTree.Node, now_tmp: bool) !void;
-fn mm_process_remaining_children(ctx: *MagicMount, allocator: Allocator, path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTree.Node, now_tmp: bool) !void;
-fn mm_apply_regular_file(ctx: *MagicMount, path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTree.Node, has_tmpfs: bool) !void;
-fn mm_apply_symlink(ctx: *MagicMount, allocator: Allocator, path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTree.Node) !void;
+// --- Apply state ---
+//
+// The applier walks the mount tree with an explicit stack instead of native
+// recursion, so stack use no longer grows with tree depth. `path` (real
+// location) and `wpath` (workdir location) are shared incremental buffers:
+// entering a node pushes one component, leaving it pops back to the mark.
+const DirPhase = enum { real_children, remaining_children };
+
+const DirFrame = struct {
+    node: *ModuleTree.Node,
+    now_tmp: bool,
+    create_tmp: bool,
+    listing: ?RealDir,
+    phase: DirPhase = .real_children,
+    index: usize = 0,
+    path_mark: usize,
+    wpath_mark: usize,
+    // a new tmpfs dir: where the applier's log and index stood when it was
+    // entered; what is recorded inside only counts once the dir is moved
+    // into place
+    log_mark: MountLogMark = .{},
+    index_mark: PathIndex.Builder.Mark = .{},
+};
+
+const MirrorFrame = struct {
+    listing: RealDir,
+    index: usize = 0,
+    path_mark: usize,
+    wpath_mark: usize,
+};
+
+// Each applier owns its stats and failure list; with several workers they
+// are merged into the context once all of them are done.
+const Applier = struct {
+    ctx: *const MagicMount,
+    allocator: Allocator,
+    work: *WorkDir,
+    path: Utils.PathBuf = .{},
+    wpath: Utils.PathBuf = .{},
+    dirs: ArrayList(DirFrame),
+    mirrors: ArrayList(MirrorFrame),
+    stats: MountStats = std.mem.zeroes(MountStats),
+    failed: ArrayList([]const u8),
+    // every failed node with its reason, for the run report
+    failures: ArrayList(Report.Failure),
+    // try-umount candidates, registered in one go after the apply
+    unmountable: ArrayList([]u8),
+    log: MountLog,
+    index: PathIndex.Builder,
+    // set per task: the partition it belongs to, and whether the mount
+    // budget asks for the fewest possible mounts
+    partition: []const u8 = "",
+    minimise: bool = false,
+
+    fn init(ctx: *const MagicMount, allocator: Allocator, work: *WorkDir) Applier {
+        return .{
+            .ctx = ctx,
+            .allocator = allocator,
+            .work = work,
+            .dirs = ArrayList(DirFrame).init(allocator),
+            .mirrors = ArrayList(MirrorFrame).init(allocator),
+            .failed = ArrayList([]const u8).init(allocator),
+            .failures = ArrayList(Report.Failure).init(allocator),
+            .unmountable = ArrayList([]u8).init(allocator),
+            .log = MountLog.init(allocator),
+            .index = PathIndex.Builder.init(allocator),
+        };
+    }
+
+    fn deinit(self: *Applier) void {
+        self.reset();
+        self.dirs.deinit();
+        self.mirrors.deinit();
+        self.failed.deinit();
+        self.failures.deinit();
+        for (self.unmountable.items) |p| self.allocator.free(p);
+        self.unmountable.deinit();
+        self.log.deinit();
+        self.index.deinit();
+    }
+
+    // Drop whatever an aborted walk left on the stacks.
+    fn reset(self: *Applier) void {
+        while (self.dirs.popOrNull()) |f| {
+            var frame = f;
+            self.abandon(&frame);
+        }
+        self.mirror_abort(0);
+        self.failed.clearRetainingCapacity();
+        for (self.failures.items) |f| Report.free_failure(self.allocator, f);
+        self.failures.clearRetainingCapacity();
+    }
+
+    // Module names point into the tree, which outlives every applier.
+    fn mark_failed(self: *Applier, module_name: []const u8) void {
+        for (self.failed.items) |m| {
+            if (std.mem.eql(u8, m, module_name)) return;
+        }
+        self.failed.append(module_name) catch {};
+    }
+
+    // `name` under the current path failed with `err`
+    fn fail(self: *Applier, name: []const u8, module: ?[]const u8, err: anyerror) void {
+        const path = std.fs.path.join(self.allocator, &.{ self.path.slice(), name }) catch return;
+        const mod = if (module) |m| self.allocator.dupe(u8, m) catch null else null;
+        self.failures.append(.{ .path = path, .module = mod, .reason = @errorName(err) }) catch {
+            Report.free_failure(self.allocator, .{ .path = path, .module = mod, .reason = "" });
+        };
+    }
+
+    // A dir frame that will not be finished; a new tmpfs dir takes
+    // everything recorded inside it along.
+    fn abandon(self: *Applier, frame: *DirFrame) void {
+        if (frame.listing) |*l| l.deinit();
+        frame.listing = null;
+        if (frame.create_tmp) self.drop_staged(frame);
+    }
+
+    fn drop_staged(self: *Applier, frame: *const DirFrame) void {
+        self.log.rollback(frame.log_mark);
+        self.index.rollback(frame.index_mark);
+    }
+
+    fn record(self: *Applier, path: []const u8, source: []const u8, kind: MountKind, module: ?[]const u8) void {
+        self.log.add(path, source, kind, module, self.partition) catch {};
+    }
+
+    // `path` is a top-level mount point made from `node`
+    fn unit(self: *Applier, path: []const u8, node: *ModuleTree.Node) void {
+        const digest = mm_unit_digest(self.ctx, self.allocator, node, self.minimise);
+        self.log.add_unit(path, digest) catch {};
+    }
+
+    // the current path is now served by `node`, put in place as `strategy`
+    fn indexed(self: *Applier, node: *const ModuleTree.Node, strategy: PathIndex.Strategy) void {
+        const kind: PathIndex.Kind = switch (node.type) {
+            .REGULAR => .file,
+            .SYMLINK => .symlink,
+            .WHITEOUT => .whiteout,
+            .DIRECTORY => .dir,
+        };
+        self.index.add(self.path.slice(), node.module_name, kind, strategy) catch {};
+    }
+
+    fn add_unmountable(self: *Applier, path: []const u8) void {
+        const copy = self.allocator.dupe(u8, path) catch return;
+        self.unmountable.append(copy) catch self.allocator.free(copy);
+    }
+
+    fn enter(self: *Applier, name: []const u8) !struct { usize, usize } {
+        const pm = try self.path.push(name);
+        const wm = self.wpath.push(name) catch |err| {
+            self.path.pop(pm);
+            return err;
+        };
+        return .{ pm, wm };
+    }
+
+    fn leave(self: *Applier, pm: usize, wm: usize) void {
+        self.path.pop(pm);
+        self.wpath.pop(wm);
+    }
+
+    fn mirror_abort(self: *Applier, depth: usize) void {
+        while (self.mirrors.items.len > depth) {
+            var frame = self.mirrors.pop();
+            frame.listing.deinit();
+            self.leave(frame.path_mark, frame.wpath_mark);
+        }
+    }
+};
 
 // --- Clone symlink ---
-fn mm_clone_symlink(allocator: Allocator, src: [*:0]const u8, dst: [*:0]const u8) !void {
+fn mm_clone_symlink(work: *WorkDir, src: [*:0]const u8, dst: [*:0]const u8) !void {
     var target_buf: [PATH_MAX]u8 = undefined;
     const target = target_buf[0..];
 
     const len = try os.readlink(src, target);
-    const target_z = target[0..len] ++ [_]u8{0};
 
-    try os.symlink(target_z.ptr, dst);
-    _ = Utils.copy_selcon(src, dst); // ignore error
+    const con = work.selcon.read_path(src) catch null;
+    try work.symlink(target[0..len], dst, con);
 
-    LOG(LOG_DEBUG, "clone symlink {s} -> {s} ({s})", .{ src, dst, target_z.ptr });
+    LOG(LOG_DEBUG, "clone symlink {s} -> {s} ({s})", .{ src, dst, target[0..len] });
 }
 
-// --- Mirror directory entry (for tmpfs overlay of original content) ---
-fn mm_mirror_entry(ctx: *MagicMount, allocator: Allocator, path: [*:0]const u8, work: [*:0]const u8, name: [*:0]const u8) !void {
-    var src_buf: [PATH_MAX]u8 = undefined;
-    var dst_buf: [PATH_MAX]u8 = undefined;
-    const src = Utils.path_join(allocator, &src_buf, path, name) catch return;
-    const dst = Utils.path_join(allocator, &dst_buf, work, name) catch return;
-
-    const st = os.lstat(src) catch |err| {
-        LOG(LOG_WARN, "lstat {s}: {s}", .{ src, @errorName(err) });
-        return;
-    };
+// Mirror the entry at the current path/wpath. Directories are opened and
+// pushed onto the mirror stack, everything else is done in place.
+fn mm_mirror_one(ap: *Applier, real: *RealDir, entry: *RealEntry, pm: usize, wm: usize) !void {
+    const src = ap.path.slice();
+    const dst = ap.wpath.slice();
+
+    switch (real.kind(entry)) {
+        .regular => {
+            defer ap.leave(pm, wm);
+            // the bind mount hides the placeholder's own mode
+            try ap.work.file(dst, 0o644);
+
+            try linux.mount(src, dst, null, linux.MS_BIND, null);
+            // a mount like any other, charged to the module that made the tmpfs
+            const owner = ap.dirs.items[ap.dirs.items.len - 1].node.module_name;
+            ap.record(src, src, .mirror, owner);
+        },
+        .directory => {
+            var sub = RealDir.openat(ap.allocator, real.fd, real.name_of(entry.*)) catch |err| {
+                LOG(LOG_WARN, "opendir {s}: {s}", .{ src, @errorName(err) });
+                ap.leave(pm, wm);
+                return;
+            };
+            errdefer sub.deinit();
 
-    if (os.S.ISREG(st.mode)) {
-        const fd = try os.open(dst, .{ .mode = st.mode & 0o7777 });
-        os.close(fd);
+            const st = try os.fstat(sub.fd);
+            const con = ap.work.selcon.read_fd(sub.fd) catch null;
+            _ = try ap.work.mkdir_meta(dst, st, con);
 
-        try linux.mount(src, dst, null, linux.MS_BIND, null);
-    } else if (os.S.ISDIR(st.mode)) {
-        _ = os.mkdir(dst, st.mode & 0o7777) catch |err| {
-            if (err != error.PathAlreadyExists) return error.DirectoryCreationFailed;
-        };
-        os.chmod(dst, st.mode & 0o7777) catch {};
-        os.chown(dst, st.uid, st.gid) catch {};
+            try ap.mirrors.append(.{ .listing = sub, .path_mark = pm, .wpath_mark = wm });
+        },
+        .symlink => {
+            defer ap.leave(pm, wm);
+            try mm_clone_symlink(ap.work, src, dst);
+        },
+        else => ap.leave(pm, wm),
+    }
+}
 
-        _ = Utils.copy_selcon(src, dst);
+// --- Mirror directory entry (for tmpfs overlay of original content) ---
+fn mm_mirror_entry(ap: *Applier, real: *RealDir, entry: *RealEntry) !void {
+    const base = ap.mirrors.items.len;
+    errdefer ap.mirror_abort(base);
 
-        var dir = try std.fs.cwd().openDir(src, .{});
-        defer dir.close();
+    const marks = try ap.enter(real.name_of(entry.*));
+    mm_mirror_one(ap, real, entry, marks[0], marks[1]) catch |err| {
+        if (ap.mirrors.items.len == base) ap.leave(marks[0], marks[1]);
+        return err;
+    };
 
-        var iter = dir.iterate();
-        while (try iter.next()) |entry| {
-            if (std.mem.eql(u8, entry.name, ".") or std.mem.eql(u8, entry.name, "..")) continue;
-            try mm_mirror_entry(ctx, allocator, src, dst, entry.name.ptr);
+    while (ap.mirrors.items.len > base) {
+        const top = &ap.mirrors.items[ap.mirrors.items.len - 1];
+        if (top.index == top.listing.entries.items.len) {
+            ap.mirror_abort(ap.mirrors.items.len - 1);
+            continue;
         }
-    } else if (os.S.ISLNK(st.mode)) {
-        try mm_clone_symlink(allocator, src, dst);
+        const e = &top.listing.entries.items[top.index];
+        top.index += 1;
+
+        const m = try ap.enter(top.listing.name_of(e.*));
+        // may append to ap.mirrors, `top` is not used past this point
+        mm_mirror_one(ap, &top.listing, e, m[0], m[1]) catch |err| {
+            ap.leave(m[0], m[1]);
+            return err;
+        };
     }
 }
 
+// --- Inline copy of small module files ---
+// Inside a tmpfs dir a small file costs less as a copy than as one more
+// mount: each mount lengthens the mount table every app spawn walks.
+// Returns false if the file is too big and has to be bind-mounted.
+fn mm_inline_copy(ap: *Applier, src_path: []const u8, wpath: []const u8) !bool {
+    const src = try os.open(src_path, os.O.RDONLY | os.O.NOFOLLOW | os.O.CLOEXEC, 0);
+    defer os.close(src);
+
+    const st = try os.fstat(src);
+    const limit = mm_copy_limit(ap.ctx, ap.minimise);
+    if (!os.S.ISREG(st.mode) or @as(u64, @intCast(st.size)) > limit) return false;
+
+    // a bind mount would show the module file's own label
+    const con = ap.work.selcon.read_fd(src) catch null;
+    try ap.work.copy(src, wpath, st, con);
+
+    LOG(LOG_DEBUG, "inline copy {s} -> {s} ({d} bytes)", .{ src_path, wpath, st.size });
+    ap.stats.inline_files += 1;
+    ap.stats.inline_bytes += @intCast(st.size);
+    ap.stats.nodes_mounted += 1;
+    return true;
+}
+
 // --- Apply regular file (from module) ---
-fn mm_apply_regular_file(ctx: *MagicMount, path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTree.Node, has_tmpfs: bool) !void {
+fn mm_apply_regular_file(ap: *Applier, node: *ModuleTree.Node, has_tmpfs: bool) !void {
+    const ctx = ap.ctx;
+    const path = ap.path.slice();
+    const wpath = ap.wpath.slice();
     const target = if (has_tmpfs) wpath else path;
 
-    if (has_tmpfs) {
-        const last_slash = std.mem.lastIndexOfScalar(u8, wpath[0..std.mem.indexOfScalar(u8, wpath, 0).?], '/') orelse return;
-        const parent = wpath[0..last_slash];
-        try Utils.mkdir_p(parent);
-
-        const fd = try os.open(wpath, .{ .mode = 0o644 });
-        os.close(fd);
-    }
-
     if (node.module_path == null) {
         LOG(LOG_ERROR, "no module file for {s}", .{path});
         return error.InvalidArgument;
     }
 
+    if (has_tmpfs and (ctx.inline_copy_kb > 0 or ap.minimise)) {
+        if (try mm_inline_copy(ap, node.module_path.?, wpath)) {
+            ap.indexed(node, .copy);
+            return;
+        }
+    }
+
+    if (has_tmpfs) {
+        // parent dir fd is cached by the workdir, no per-file mkdir_p walk
+        try ap.work.file(wpath, 0o644);
+    }
+
     LOG(LOG_DEBUG, "bind {s} -> {s}", .{ node.module_path.?, target });
 
     try linux.mount(node.module_path.?, target, null, linux.MS_BIND, null);
+    ap.record(path, node.module_path.?, .bind, node.module_name);
+    ap.indexed(node, .bind);
+    if (!has_tmpfs) ap.unit(path, node);
 
     // Report to KSU if not in workdir
-    if (!std.mem.containsAtLeast(u8, target, 0, ".magic_mount/workdir/", 1)) {
-        if (ctx.enable_unmountable) {
-            _ = Ksu.ksu_send_unmountable(path);
-        }
-    }
+    if (!has_tmpfs and ctx.enable_unmountable) ap.add_unmountable(path);
 
     _ = linux.mount(null, target, null, linux.MS_REMOUNT | linux.MS_BIND | linux.MS_RDONLY, null) catch {};
 
-    ctx.stats.nodes_mounted += 1;
+    ap.stats.nodes_mounted += 1;
 }
 
 // --- Apply symlink from module ---
-fn mm_apply_symlink(ctx: *MagicMount, allocator: Allocator, path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTree.Node) !void {
+fn mm_apply_symlink(ap: *Applier, node: *ModuleTree.Node) !void {
     if (node.module_path == null) {
-        LOG(LOG_ERROR, "no module symlink for {s}", .{path});
+        LOG(LOG_ERROR, "no module symlink for {s}", .{ap.path.slice()});
         return error.InvalidArgument;
     }
 
-    try mm_clone_symlink(allocator, node.module_path.?, wpath);
-    ctx.stats.nodes_mounted += 1;
+    try mm_clone_symlink(ap.work, node.module_path.?, ap.wpath.slice());
+    ap.indexed(node, .symlink);
+    ap.stats.nodes_mounted += 1;
 }
 
 // --- Check if tmpfs is needed for a directory ---
-fn mm_check_need_tmpfs(node: *ModuleTree.Node, path: [*:0]const u8) bool {
+fn mm_check_need_tmpfs(node: *ModuleTree.Node, path: [*:0]const u8, real: ?*RealDir) bool {
     for (node.children.items) |child| {
-        var rp_buf: [PATH_MAX]u8 = undefined;
-        const rp = Utils.path_join(std.heap.page_allocator, &rp_buf, path, child.name) catch continue;
+        // a compressed chain is judged by its first level here, the rest
+        // is checked when the chain itself is applied
+        const first = if (std.mem.indexOfScalar(u8, child.name, '/')) |s| child.name[0..s] else child.name;
+        const entry = if (real) |r| r.find(first) else null;
 
         var need = false;
 
         if (child.type == .SYMLINK) {
             need = true;
         } else if (child.type == .WHITEOUT) {
-            need = Utils.path_exists(rp);
-        } else {
-            const st = os.lstat(rp) catch {
-                need = true;
-                continue;
-            };
-            const rt = ModuleTree.node_type_from_stat(st);
+            need = entry != null;
+        } else if (entry) |e| {
+            const rt = real.?.node_type(e);
             if (rt != child.type or rt == .SYMLINK) need = true;
+        } else {
+            need = true;
         }
 
         if (need and node.module_path == null) {
             LOG(LOG_ERROR, "cannot create tmpfs on {s} ({s}) - child type: {}, target exists: {}", .{
-                path, child.name, @intFromEnum(child.type), Utils.path_exists(rp) });
+                path, child.name, @intFromEnum(child.type), entry != null });
             child.skip = true;
             continue;
         }
@@ -221,9 +516,250 @@ fn mm_check_need_tmpfs(node: *ModuleTree.Node, path: [*:0]const u8) bool {
     return false;
 }
 
+// --- Mount budget ---
+//
+// Over the max_mounts budget, files in a tmpfs are copied in up to
+// MINIMISE_COPY_KB whatever inline_copy_kb says, and a directory whose
+// module files would each be bind-mounted gets a tmpfs of its own where that
+// adds fewer mounts. It rarely does: the tmpfs is one mount, but every real
+// file left in it is bound back in (mm_mirror_one), and a real subdirectory
+// file by file.
+const MINIMISE_COPY_KB = 1024;
+
+fn mm_copy_limit(ctx: *const MagicMount, minimise: bool) u64 {
+    var limit_kb: i32 = ctx.inline_copy_kb;
+    if (minimise) limit_kb = @max(limit_kb, MINIMISE_COPY_KB);
+    return @as(u64, @intCast(limit_kb)) * 1024;
+}
+
+fn mm_want_tmpfs(ctx: *const MagicMount, node: *ModuleTree.Node, path: [*:0]const u8, real: ?*RealDir, minimise: bool) bool {
+    if (mm_check_need_tmpfs(node, path, real)) return true;
+    if (!minimise or node.module_path == null or node.replace) return false;
+
+    // binds the tmpfs saves: module files small enough to be copied instead
+    const limit = mm_copy_limit(ctx, minimise);
+    var saved: usize = 0;
+    for (node.children.items) |child| {
+        if (child.type != .REGULAR or child.skip) continue;
+        const st = os.stat(child.module_path orelse continue) catch continue;
+        if (@as(u64, @intCast(st.size)) <= limit) saved += 1;
+    }
+    if (saved < 2) return false;
+
+    // mounts it adds: itself and a bind per real file mirrored into it
+    var mirrors: usize = 0;
+    if (real) |r| {
+        for (r.entries.items) |*e| {
+            const child = ModuleTree.node_child_find(node, r.name_of(e.*));
+            switch (r.kind(e)) {
+                .regular => if (child == null) {
+                    mirrors += 1;
+                },
+                // mirrored (or matched and mirrored) level by level
+                .directory => if (child == null or child.?.type == .DIRECTORY) return false,
+                else => {},
+            }
+        }
+    }
+    return mirrors + 1 < saved;
+}
+
+// Upper bound of the mounts `part` adds: one per module file, plus for each
+// directory that needs a tmpfs the tmpfs itself and a bind per real file
+// mirrored into it. Counted per module into `per_module`.
+const EstimateFrame = struct { node: *ModuleTree.Node, index: usize = 0, mark: usize, tmp: bool };
+
+fn mm_estimate_mounts(allocator: Allocator, part: *ModuleTree.Node, per_module: *Tally) usize {
+    var path = Utils.PathBuf.init("/") catch return 0;
+    var stack = ArrayList(EstimateFrame).init(allocator);
+    defer stack.deinit();
+
+    const root_mark = path.push(part.name) catch return 0;
+    const root_tmp = part.replace or mm_estimate_needs_tmpfs(allocator, part, path.slice());
+    var total = mm_estimate_dir(allocator, part, path.slice(), root_tmp, per_module);
+    stack.append(.{ .node = part, .mark = root_mark, .tmp = root_tmp }) catch return total;
+
+    while (stack.items.len > 0) {
+        const top = &stack.items[stack.items.len - 1];
+        if (top.index >= top.node.children.items.len) {
+            path.pop(top.mark);
+            _ = stack.pop();
+            continue;
+        }
+        const c = top.node.children.items[top.index];
+        top.index += 1;
+        if (c.skip) continue;
+        switch (c.type) {
+            .REGULAR => {
+                total += 1;
+                per_module.add(c.module_name orelse "(none)");
+            },
+            .DIRECTORY => {
+                const parent_tmp = top.tmp;
+                const mark = path.push(c.name) catch continue;
+                const tmp = parent_tmp or c.replace or mm_estimate_needs_tmpfs(allocator, c, path.slice());
+                if (tmp and !parent_tmp) total += mm_estimate_dir(allocator, c, path.slice(), true, per_module);
+                // `top` is invalidated by the append
+                stack.append(.{ .node = c, .mark = mark, .tmp = tmp }) catch path.pop(mark);
+            },
+            else => {},
+        }
+    }
+    return total;
+}
+
+fn mm_estimate_needs_tmpfs(allocator: Allocator, node: *ModuleTree.Node, path: [:0]const u8) bool {
+    var listing = RealDir.open(allocator, path) catch return mm_check_need_tmpfs(node, path, null);
+    defer listing.deinit();
+    return mm_check_need_tmpfs(node, path, &listing);
+}
+
+// The tmpfs at `path` (if `tmp`) and the real files mirrored into it.
+fn mm_estimate_dir(allocator: Allocator, node: *ModuleTree.Node, path: [:0]const u8, tmp: bool, per_module: *Tally) usize {
+    if (!tmp) return 0;
+    const owner = node.module_name orelse "(none)";
+    var n: usize = 1;
+    if (!node.replace) {
+        if (RealDir.open(allocator, path)) |listing| {
+            n += mm_count_mirrors(allocator, listing, node);
+        } else |_| {}
+    }
+    per_module.add_n(owner, n);
+    return n;
+}
+
+// Real regular files below `real` that no module entry hides; takes
+// ownership of `real`.
+const MirrorCount = struct { dir: RealDir, node: ?*ModuleTree.Node, index: usize = 0 };
+
+fn mm_count_mirrors(allocator: Allocator, real: RealDir, node: ?*ModuleTree.Node) usize {
+    var stack = ArrayList(MirrorCount).init(allocator);
+    defer {
+        for (stack.items) |*f| f.dir.deinit();
+        stack.deinit();
+    }
+    stack.append(.{ .dir = real, .node = node }) catch {
+        var r = real;
+        r.deinit();
+        return 0;
+    };
+
+    var n: usize = 0;
+    while (stack.items.len > 0) {
+        const top = &stack.items[stack.items.len - 1];
+        if (top.index >= top.dir.entries.items.len) {
+            var done = stack.pop();
+            done.dir.deinit();
+            continue;
+        }
+        const e = &top.dir.entries.items[top.index];
+        top.index += 1;
+
+        const name = top.dir.name_of(e.*);
+        const child = if (top.node) |tn| ModuleTree.node_child_find(tn, name) else null;
+        if (child) |c| {
+            if (c.type != .DIRECTORY or c.replace) continue;
+        }
+        switch (top.dir.kind(e)) {
+            .regular => if (child == null) {
+                n += 1;
+            },
+            .directory => {
+                const sub = RealDir.openat(allocator, top.dir.fd, name) catch continue;
+                // `top` is invalidated by the append
+                stack.append(.{ .dir = sub, .node = child }) catch {
+                    var d = sub;
+                    d.deinit();
+                };
+            },
+            else => {},
+        }
+    }
+    return n;
+}
+
+// --- Unit digests ---
+//
+// What an incremental apply compares: a digest of everything below a unit
+// that decides what gets mounted there. Entries are hashed by their path
+// relative to the unit and summed, so neither child order nor whether a
+// directory chain happens to be compressed changes it. Module files and
+// symlinks add their inode and mtime, so one replaced in place is seen too.
+const DigestFrame = struct { node: *ModuleTree.Node, index: usize = 0, mark: usize };
+
+fn mm_unit_digest(ctx: *const MagicMount, allocator: Allocator, node: *ModuleTree.Node, minimise: bool) u64 {
+    var rel: Utils.PathBuf = .{};
+    var sum: u64 = mm_entry_hash(node, "");
+
+    var stack = ArrayList(DigestFrame).init(allocator);
+    defer stack.deinit();
+    if (node.type == .DIRECTORY) stack.append(.{ .node = node, .mark = 0 }) catch return 0;
+
+    while (stack.items.len > 0) {
+        const top = &stack.items[stack.items.len - 1];
+        if (top.index >= top.node.children.items.len) {
+            rel.pop(top.mark);
+            _ = stack.pop();
+            continue;
+        }
+        const child = top.node.children.items[top.index];
+        top.index += 1;
+        if (child.skip) continue;
+
+        const mark = rel.push(child.name) catch return 0;
+        sum +%= mm_entry_hash(child, rel.slice());
+        if (child.type != .DIRECTORY) {
+            rel.pop(mark);
+            continue;
+        }
+        stack.append(.{ .node = child, .mark = mark }) catch return 0;
+    }
+
+    var h = std.hash.Wyhash.init(sum);
+    h.update(std.mem.asBytes(&ctx.inline_copy_kb));
+    h.update(&[_]u8{@intFromBool(minimise)});
+    return h.final();
+}
+
+fn mm_entry_hash(n: *const ModuleTree.Node, rel: []const u8) u64 {
+    // a directory only matters where it ends or hides what is below it
+    if (n.type == .DIRECTORY and !n.replace) {
+        for (n.children.items) |c| {
+            if (!c.skip) return 0;
+        }
+    }
+
+    var h = std.hash.Wyhash.init(0);
+    h.update(rel);
+    h.update(&[_]u8{ @intFromEnum(n.type), @intFromBool(n.replace) });
+    const mp = n.module_path orelse return h.final();
+    h.update(mp);
+
+    if (n.type == .REGULAR or n.type == .SYMLINK) {
+        var buf: [PATH_MAX]u8 = undefined;
+        if (mp.len < buf.len) {
+            @memcpy(buf[0..mp.len], mp);
+            buf[mp.len] = 0;
+            var stx: linux.Statx = undefined;
+            const rc = linux.statx(linux.AT.FDCWD, buf[0..mp.len :0], linux.AT.SYMLINK_NOFOLLOW, linux.STATX_INO | linux.STATX_MTIME | linux.STATX_SIZE, &stx);
+            if (linux.getErrno(rc) == .SUCCESS) {
+                h.update(std.mem.asBytes(&stx.ino));
+                h.update(std.mem.asBytes(&stx.size));
+                h.update(std.mem.asBytes(&stx.mtime.tv_sec));
+                h.update(std.mem.asBytes(&stx.mtime.tv_nsec));
+            }
+        }
+    }
+    return h.final();
+}
+
 // --- Set up tmpfs dir with metadata ---
-fn mm_setup_dir_tmpfs(path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTree.Node) !void {
-    try Utils.mkdir_p(wpath);
+fn mm_setup_dir_tmpfs(work: *WorkDir, path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTree.Node, real: ?*RealDir) !void {
+    if (real) |r| {
+        const st = try os.fstat(r.fd);
+        _ = try work.mkdir_meta(wpath, st, work.selcon.read_fd(r.fd) catch null);
+        return;
+    }
 
     const st = os.stat(path) catch |err1| {
         if (node.module_path) |mp| {
@@ -231,10 +767,7 @@ fn mm_setup_dir_tmpfs(path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTr
                 LOG(LOG_ERROR, "no dir meta for {s}", .{path});
                 return err1;
             };
-            try Utils.mkdir_p(wpath);
-            os.chmod(wpath, st2.mode & 0o7777) catch {};
-            os.chown(wpath, st2.uid, st2.gid) catch {};
-            _ = Utils.copy_selcon(mp, wpath);
+            _ = try work.mkdir_meta(wpath, st2, work.selcon.read_path(mp) catch null);
             return;
         } else {
             LOG(LOG_ERROR, "no dir meta for {s}", .{path});
@@ -242,150 +775,1158 @@ fn mm_setup_dir_tmpfs(path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTr
         }
     };
 
-    os.chmod(wpath, st.mode & 0o7777) catch {};
-    os.chown(wpath, st.uid, st.gid) catch {};
-    _ = Utils.copy_selcon(path, wpath);
+    _ = try work.mkdir_meta(wpath, st, work.selcon.read_path(path) catch null);
 }
 
-// --- Process existing children in original dir ---
-fn mm_process_dir_children(ctx: *MagicMount, allocator: Allocator, path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTree.Node, now_tmp: bool) !void {
-    if (!Utils.path_exists(path) or node.replace) return;
+// --- Enter a directory node: decide tmpfs, set it up, push its frame ---
+fn mm_enter_dir(ap: *Applier, node: *ModuleTree.Node, has_tmpfs: bool, pm: usize, wm: usize) !void {
+    const path = ap.path.slice();
+    const wpath = ap.wpath.slice();
+
+    // Read the real directory once; need-check, metadata, child
+    // matching and mirroring all share this listing.
+    var listing: ?RealDir = null;
+    errdefer if (listing) |*l| l.deinit();
+    if (!node.replace) {
+        listing = RealDir.open(ap.allocator, path) catch |err| blk: {
+            if (err != error.FileNotFound) {
+                LOG(LOG_ERROR, "opendir {s}: {s}", .{ path, @errorName(err) });
+                return err;
+            }
+            break :blk null;
+        };
+    }
+    const real: ?*RealDir = if (listing) |*l| l else null;
 
-    var dir = std.fs.cwd().openDir(path, .{}) catch |err| {
-        if (!now_tmp) return;
-        LOG(LOG_ERROR, "opendir {s}: {s}", .{ path, @errorName(err) });
-        return err;
-    };
-    defer dir.close();
+    var create_tmp = (!has_tmpfs and node.replace and node.module_path != null);
+    if (!has_tmpfs and !create_tmp) {
+        create_tmp = mm_want_tmpfs(ap.ctx, node, path, real, ap.minimise);
+    }
+    const now_tmp = has_tmpfs or create_tmp;
 
-    var iter = dir.iterate();
-    while (try iter.next()) |entry| {
-        if (std.mem.eql(u8, entry.name, ".") or std.mem.eql(u8, entry.name, "..")) continue;
+    if (now_tmp) try mm_setup_dir_tmpfs(ap.work, path, wpath, node, real);
 
-        const child = ModuleTree.node_child_find(node, entry.name.ptr);
-        if (child) |c| {
-            if (c.skip) {
-                c.done = true;
-                continue;
-            }
-            c.done = true;
-            mm_apply_node_recursive(ctx, allocator, path, wpath, c, now_tmp) catch |err| {
-                const mn = if (c.module_name) |mn| mn else if (node.module_name) |mn| mn else null;
-                if (mn) |name| {
-                    LOG(LOG_ERROR, "child {s}/{s} failed (module: {s})", .{ path, c.name, name });
-                    ModuleTree.module_mark_failed(ctx, name);
-                } else {
-                    LOG(LOG_ERROR, "child {s}/{s} failed (no module_name)", .{ path, c.name });
+    if (create_tmp) {
+        try linux.mount(wpath, wpath, null, linux.MS_BIND, null);
+    }
+
+    // real entries are matched one level at a time below a tmpfs
+    if (now_tmp) try ModuleTree.node_expand_chains(ap.allocator, node);
+
+    try ap.dirs.append(.{
+        .node = node,
+        .now_tmp = now_tmp,
+        .create_tmp = create_tmp,
+        .listing = listing,
+        // replace dirs hide the original content entirely
+        .phase = if (node.replace) .remaining_children else .real_children,
+        .path_mark = pm,
+        .wpath_mark = wm,
+        .log_mark = ap.log.mark(),
+        .index_mark = ap.index.mark(),
+    });
+}
+
+// --- Apply one node; directories are only entered, see mm_apply_tree ---
+// `parent_fd` is the parent's real directory, if it exists.
+fn mm_apply_node(ap: *Applier, node: *ModuleTree.Node, has_tmpfs: bool, parent_fd: ?os.fd_t) !void {
+    if (ModuleTree.node_is_chain(node)) {
+        const plain = !has_tmpfs and parent_fd != null and chain_is_plain(parent_fd.?, node.name);
+        if (!plain) {
+            LOG(LOG_DEBUG, "expand chain {s}/{s}", .{ ap.path.slice(), node.name });
+            try ModuleTree.node_chain_expand(ap.allocator, node);
+        }
+    }
+
+    const marks = try ap.enter(node.name);
+    const pm = marks[0];
+    const wm = marks[1];
+
+    if (node.type == .DIRECTORY) {
+        mm_enter_dir(ap, node, has_tmpfs, pm, wm) catch |err| {
+            ap.leave(pm, wm);
+            return err;
+        };
+        return;
+    }
+
+    defer ap.leave(pm, wm);
+    switch (node.type) {
+        .REGULAR => try mm_apply_regular_file(ap, node, has_tmpfs),
+        .SYMLINK => try mm_apply_symlink(ap, node),
+        .WHITEOUT => {
+            LOG(LOG_DEBUG, "whiteout {s}", .{ap.path.slice()});
+            ap.indexed(node, .whiteout);
+            ap.stats.nodes_whiteout += 1;
+        },
+        .DIRECTORY => unreachable,
+    }
+}
+
+// --- Next child of the top frame to apply, mirroring untouched entries ---
+fn mm_next_child(ap: *Applier, frame_idx: usize) ?*ModuleTree.Node {
+    const frame = &ap.dirs.items[frame_idx];
+    const node = frame.node;
+
+    if (frame.phase == .real_children) {
+        if (frame.listing) |*r| {
+            while (frame.index < r.entries.items.len) {
+                const entry = &r.entries.items[frame.index];
+                frame.index += 1;
+
+                const child = ModuleTree.node_child_find(node, r.name_of(entry.*));
+                if (child) |c| {
+                    c.done = true;
+                    if (c.skip) continue;
+                    return c;
+                } else if (frame.now_tmp) {
+                    mm_mirror_entry(ap, r, entry) catch {};
                 }
-                ctx.stats.nodes_fail += 1;
-                if (now_tmp) return err;
+            }
+        }
+        frame.phase = .remaining_children;
+        frame.index = 0;
+    }
+
+    while (frame.index < node.children.items.len) {
+        const child = node.children.items[frame.index];
+        frame.index += 1;
+        if (child.skip or child.done) continue;
+        return child;
+    }
+    return null;
+}
+
+// --- Finish a directory once all of its children are applied ---
+fn mm_finish_dir(ap: *Applier, frame: *DirFrame) !void {
+    const ctx = ap.ctx;
+    defer {
+        if (frame.listing) |*l| l.deinit();
+        ap.leave(frame.path_mark, frame.wpath_mark);
+    }
+
+    if (frame.create_tmp) {
+        const path = ap.path.slice();
+        const wpath = ap.wpath.slice();
+        // never moved into place, nothing inside it is mounted
+        errdefer ap.drop_staged(frame);
+
+        var mark_buf: [16]u8 = undefined;
+        _ = linux.lsetxattr(wpath, Verify.RUN_MARK_XATTR, run_mark(&mark_buf, ctx.run_id), 0) catch {};
+        _ = linux.mount(null, wpath, null, linux.MS_REMOUNT | linux.MS_BIND | linux.MS_RDONLY, null) catch {};
+
+        try linux.mount(wpath, path, null, linux.MS_MOVE, null);
+        LOG(LOG_INFO, "move mountpoint success: {s} -> {s}", .{ wpath, path });
+        _ = linux.mount(null, path, null, linux.MS_REC | linux.MS_PRIVATE, null) catch {};
+        ap.record(path, std.mem.sliceTo(ap.ctx.mount_source, 0), .tmpfs, frame.node.module_name);
+        ap.unit(path, frame.node);
+        ap.indexed(frame.node, .tmpfs);
+
+        if (ctx.enable_unmountable) ap.add_unmountable(path);
+    } else if (frame.now_tmp and frame.node.module_name != null) {
+        ap.indexed(frame.node, .dir);
+    }
+    ap.stats.nodes_mounted += 1;
+}
+
+// --- Record a failed child; a tmpfs parent cannot be completed without it ---
+fn mm_child_failed(ap: *Applier, failed: *ModuleTree.Node, err: anyerror) !void {
+    var child = failed;
+
+    while (ap.dirs.items.len > 0) {
+        const parent = &ap.dirs.items[ap.dirs.items.len - 1];
+        const path = ap.path.slice();
+
+        const mn = if (child.module_name) |mn| mn else if (parent.node.module_name) |mn| mn else null;
+        if (mn) |name| {
+            LOG(LOG_ERROR, "child {s}/{s} failed (module: {s})", .{ path, child.name, name });
+            ap.mark_failed(name);
+        } else {
+            LOG(LOG_ERROR, "child {s}/{s} failed (no module_name)", .{ path, child.name });
+        }
+        ap.fail(child.name, mn, err);
+        ap.stats.nodes_fail += 1;
+        if (!parent.now_tmp) return;
+
+        // the half-built tmpfs dir is abandoned, fail upwards
+        var frame = ap.dirs.pop();
+        ap.abandon(&frame);
+        ap.leave(frame.path_mark, frame.wpath_mark);
+        child = frame.node;
+    }
+    return err;
+}
+
+// --- Iterative tree application ---
+fn mm_apply_tree(ap: *Applier, root: *ModuleTree.Node, base: []const u8, wbase: []const u8, has_tmpfs: bool, parent_fd: ?os.fd_t) !void {
+    try ap.path.set(base);
+    try ap.wpath.set(wbase);
+
+    try mm_apply_node(ap, root, has_tmpfs, parent_fd);
+
+    while (ap.dirs.items.len > 0) {
+        const top = ap.dirs.items.len - 1;
+        if (mm_next_child(ap, top)) |child| {
+            const frame = &ap.dirs.items[top];
+            const parent_fd = if (frame.listing) |l| l.fd else null;
+            mm_apply_node(ap, child, frame.now_tmp, parent_fd) catch |err| {
+                try mm_child_failed(ap, child, err);
             };
-        } else if (now_tmp) {
-            mm_mirror_entry(ctx, allocator, path, wpath, entry.name.ptr) catch {};
+            continue;
         }
+
+        var frame = ap.dirs.pop();
+        mm_finish_dir(ap, &frame) catch |err| {
+            if (ap.dirs.items.len == 0) return err;
+            try mm_child_failed(ap, frame.node, err);
+        };
     }
 }
 
-// --- Process remaining (module-only) children ---
-fn mm_process_remaining_children(ctx: *MagicMount, allocator: Allocator, path: [*:0]const u8, wpath: [*:0]const u8, node: *ModuleTree.Node, now_tmp: bool) !void {
+// --- Parallel executor ---
+//
+// Partitions, and the top-level entries of a partition that itself stays
+// untouched, are independent subtrees: nothing under /vendor depends on
+// /system, and sibling tmpfs directories never share a mountpoint. The tree
+// builder streams partitions in as it finishes them; each one is cut into
+// such subtrees (tasks) and queued for a small pool of workers, so applying
+// one partition overlaps with scanning the next. Every worker has its own
+// WorkDir, stats and failure list; results are merged in task order so the
+// report does not depend on scheduling.
+const MAX_SPLIT_DEPTH = 2;
+const MAX_AUTO_THREADS = 4;
+
+// A partition handed over by the tree builder. Its subtree is freed as soon
+// as the last task cut from it has been applied.
+const PartitionJob = struct {
+    node: *ModuleTree.Node,
+    pending: usize = 0,
+    minimise: bool = false,
+    // cut down to single units (incremental apply)
+    split_all: bool = false,
+    // the previous run's units (incremental apply), never split
+    prev: ?*const MountLog = null,
+};
+
+const ApplyTask = struct {
+    job: *PartitionJob,
+    node: *ModuleTree.Node,
+    base: []const u8,
+    parent_fd: ?os.fd_t,
+
+    // owned copies, the subtree is gone by the time they are reported
+    failed: [][]u8 = &.{},
+    failures: []Report.Failure = &.{},
+    err: ?anyerror = null,
+    err_name: ?[]u8 = null,
+    err_module: ?[]u8 = null,
+};
+
+// Everything the tasks refer to: planning happens on the scanner thread,
+// so only the queue itself (`tasks`) is shared with the workers.
+const ApplyPlan = struct {
+    arena: std.heap.ArenaAllocator,
+    tasks: ArrayList(*ApplyTask),
+    listings: ArrayList(RealDir),
+    stats: MountStats = std.mem.zeroes(MountStats),
+
+    fn init(allocator: Allocator) ApplyPlan {
+        return .{
+            .arena = std.heap.ArenaAllocator.init(allocator),
+            .tasks = ArrayList(*ApplyTask).init(allocator),
+            .listings = ArrayList(RealDir).init(allocator),
+        };
+    }
+
+    fn deinit(self: *ApplyPlan) void {
+        for (self.listings.items) |*l| l.deinit();
+        self.listings.deinit();
+        self.tasks.deinit();
+        self.arena.deinit();
+    }
+
+    fn task(self: *ApplyPlan, out: *ArrayList(*ApplyTask), job: *PartitionJob, node: *ModuleTree.Node, base: []const u8, parent_fd: ?os.fd_t) !void {
+        const t = try self.arena.allocator().create(ApplyTask);
+        t.* = .{ .job = job, .node = node, .base = base, .parent_fd = parent_fd };
+        try out.append(t);
+    }
+};
+
+// Split `node` at `path` into tasks if it is a plain directory that needs no
+// tmpfs of its own; otherwise the whole node becomes one task.
+fn mm_plan_node(ctx: *const MagicMount, plan: *ApplyPlan, out: *ArrayList(*ApplyTask), allocator: Allocator, job: *PartitionJob, node: *ModuleTree.Node, base: []const u8, parent_fd: ?os.fd_t, depth: usize) !void {
+    // units sit wherever a chain would have been checked in one go
+    if (job.split_all and node.type == .DIRECTORY and ModuleTree.node_is_chain(node)) {
+        try ModuleTree.node_chain_expand(allocator, node);
+    }
+    const splittable = (depth < MAX_SPLIT_DEPTH or job.split_all) and node.type == .DIRECTORY and
+        !node.replace and !ModuleTree.node_is_chain(node);
+    if (!splittable) return plan.task(out, job, node, base, parent_fd);
+
+    var path = try Utils.PathBuf.init(base);
+    _ = try path.push(node.name);
+
+    // Still mounted while we plan: its listing shows the previous overlay,
+    // not the real directory. Whole, it is either carried over or applied
+    // once the old mount is detached, against what is really there.
+    if (job.prev) |prev| {
+        if (prev.find_unit(path.slice()) != null) return plan.task(out, job, node, base, parent_fd);
+    }
+
+    var listing = RealDir.open(allocator, path.slice()) catch {
+        return plan.task(out, job, node, base, parent_fd);
+    };
+    if (mm_want_tmpfs(ctx, node, path.slice(), &listing, job.minimise)) {
+        listing.deinit();
+        return plan.task(out, job, node, base, parent_fd);
+    }
+    try plan.listings.append(listing);
+    // the fd value stays valid until plan.deinit
+    const fd = listing.fd;
+    const child_base = try plan.arena.allocator().dupe(u8, path.slice());
+
     for (node.children.items) |child| {
-        if (child.skip or child.done) continue;
-        mm_apply_node_recursive(ctx, allocator, path, wpath, child, now_tmp) catch |err| {
-            const mn = if (child.module_name) |mn| mn else if (node.module_name) |mn| mn else null;
-            if (mn) |name| {
-                LOG(LOG_ERROR, "child {s}/{s} failed (module: {s})", .{ path, child.name, name });
-                ModuleTree.module_mark_failed(ctx, name);
-            } else {
-                LOG(LOG_ERROR, "child {s}/{s} failed (no module_name)", .{ path, child.name });
+        if (child.skip) continue;
+        try mm_plan_node(ctx, plan, out, allocator, job, child, child_base, fd, depth + 1);
+    }
+    plan.stats.nodes_mounted += 1;
+}
+
+fn mm_free_subtree(allocator: Allocator, node: *ModuleTree.Node) void {
+    node.deinit(allocator);
+    allocator.destroy(node);
+}
+
+const Executor = struct {
+    ctx: *const MagicMount,
+    allocator: Allocator,
+    tmp_dir: []const u8,
+    plan: *ApplyPlan,
+    // real "/" listing, parent of every partition
+    root: *RealDir,
+    threads: ArrayList(std.Thread),
+
+    mutex: std.Thread.Mutex = .{},
+    cond: std.Thread.Condition = .{},
+    next: usize = 0,
+    closed: bool = false,
+    stats: MountStats = std.mem.zeroes(MountStats),
+    setup_err: ?anyerror = null,
+    unmountable: ArrayList([]u8),
+    log: MountLog,
+    index: PathIndex.Builder,
+
+    // scanner thread only
+    mounts_planned: usize = 0,
+    over_budget: bool = false,
+    baseline: ?*Baseline = null,
+
+    fn init(ctx: *const MagicMount, allocator: Allocator, tmp_dir: []const u8, plan: *ApplyPlan, root: *RealDir) Executor {
+        return .{
+            .ctx = ctx,
+            .allocator = allocator,
+            .tmp_dir = tmp_dir,
+            .plan = plan,
+            .root = root,
+            .threads = ArrayList(std.Thread).init(allocator),
+            .unmountable = ArrayList([]u8).init(allocator),
+            .log = MountLog.init(allocator),
+            .index = PathIndex.Builder.init(allocator),
+        };
+    }
+
+    fn deinit(self: *Executor) void {
+        for (self.unmountable.items) |p| self.allocator.free(p);
+        self.unmountable.deinit();
+        self.log.deinit();
+        self.index.deinit();
+    }
+
+    fn start(self: *Executor, nthreads: usize) void {
+        self.threads.ensureTotalCapacity(nthreads) catch return;
+        var i: usize = 0;
+        while (i < nthreads) : (i += 1) {
+            const t = std.Thread.spawn(.{}, mm_worker, .{self}) catch |err| {
+                LOG(LOG_WARN, "spawn apply worker: {s}", .{@errorName(err)});
+                break;
+            };
+            self.threads.appendAssumeCapacity(t);
+        }
+    }
+
+    // Cut one partition into tasks and queue them. Runs on the scanner
+    // thread; takes ownership of `part`.
+    fn submit(self: *Executor, part: *ModuleTree.Node) !void {
+        errdefer |err| {
+            LOG(LOG_ERROR, "queue partition {s}: {s}", .{ part.name, @errorName(err) });
+            mm_free_subtree(self.allocator, part);
+        }
+
+        const plan = self.plan;
+        const job = try plan.arena.allocator().create(PartitionJob);
+        job.* = .{ .node = part, .split_all = self.baseline != null };
+        if (self.baseline) |b| job.prev = &b.prev;
+
+        const entry = self.root.find(part.name);
+        if (entry == null or self.root.kind(entry.?) != .directory) {
+            LOG(LOG_ERROR, "cannot create tmpfs on / ({s}) - target exists: {}", .{ part.name, entry != null });
+            mm_free_subtree(self.allocator, part);
+            return;
+        }
+
+        self.check_budget(job);
+
+        var out = ArrayList(*ApplyTask).init(self.allocator);
+        defer out.deinit();
+        try mm_plan_node(self.ctx, plan, &out, self.allocator, job, part, "/", self.root.fd, 1);
+
+        if (self.baseline) |b| {
+            self.keep_unchanged(b, job, &out);
+            // before anything new lands where an old mount still sits
+            b.detach(self.allocator, part.name);
+        }
+
+        if (out.items.len == 0) {
+            mm_free_subtree(self.allocator, part);
+            return;
+        }
+
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        try plan.tasks.appendSlice(out.items);
+        job.pending = out.items.len;
+        self.cond.broadcast();
+    }
+
+    // Drop the tasks whose unit the previous run left unchanged and in place;
+    // their records are carried over into this run's log.
+    fn keep_unchanged(self: *Executor, b: *Baseline, job: *PartitionJob, tasks: *ArrayList(*ApplyTask)) void {
+        var kept: usize = 0;
+        for (tasks.items) |t| {
+            const carried = blk: {
+                var path = Utils.PathBuf.init(t.base) catch break :blk false;
+                _ = path.push(t.node.name) catch break :blk false;
+                const digest = mm_unit_digest(self.ctx, self.allocator, t.node, job.minimise);
+                const keep = b.unchanged(path.slice(), digest) orelse break :blk false;
+
+                self.mutex.lock();
+                defer self.mutex.unlock();
+                b.carry(keep, &self.log);
+                break :blk true;
+            };
+            if (carried) continue;
+            tasks.items[kept] = t;
+            kept += 1;
+        }
+        tasks.shrinkRetainingCapacity(kept);
+    }
+
+    // Partitions arrive one at a time, so the budget is checked against a
+    // running estimate: the partition that crosses it, and every one after
+    // it, is applied mount-minimising.
+    fn check_budget(self: *Executor, job: *PartitionJob) void {
+        const budget = self.ctx.max_mounts;
+        if (budget <= 0) return;
+
+        var per_module = Tally.init(self.allocator);
+        defer per_module.deinit();
+        self.mounts_planned += mm_estimate_mounts(self.allocator, job.node, &per_module);
+        if (self.mounts_planned <= @as(usize, @intCast(budget))) return;
+
+        job.minimise = true;
+        if (self.over_budget) return;
+        self.over_budget = true;
+
+        LOG(LOG_WARN, "mount budget {d} exceeded at /{s} (~{d} mounts planned), minimising mounts from here on", .{
+            budget, job.node.name, self.mounts_planned });
+        for (per_module.sorted()) |e| {
+            LOG(LOG_WARN, "  /{s}: module {s} ~{d} mounts", .{ job.node.name, e.name, e.count });
+        }
+    }
+
+    fn close_queue(self: *Executor) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.closed = true;
+        self.cond.broadcast();
+    }
+
+    // No more partitions: let the workers drain the queue and exit.
+    // Returns how many threads did the work.
+    fn finish(self: *Executor) usize {
+        self.close_queue();
+        const n = self.threads.items.len;
+        if (n == 0) {
+            // no worker could be started, apply on the calling thread
+            mm_worker(self);
+        }
+        for (self.threads.items) |t| t.join();
+        self.threads.deinit();
+        return @max(n, 1);
+    }
+
+    fn take(self: *Executor) ?*ApplyTask {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        while (true) {
+            if (self.next < self.plan.tasks.items.len) {
+                const t = self.plan.tasks.items[self.next];
+                self.next += 1;
+                return t;
             }
-            ctx.stats.nodes_fail += 1;
-            if (now_tmp) return err;
+            if (self.closed) return null;
+            self.cond.wait(&self.mutex);
+        }
+    }
+
+    fn done(self: *Executor, t: *ApplyTask) void {
+        const last = blk: {
+            self.mutex.lock();
+            defer self.mutex.unlock();
+            t.job.pending -= 1;
+            break :blk t.job.pending == 0;
         };
+        if (last) mm_free_subtree(self.allocator, t.job.node);
+    }
+};
+
+fn mm_stats_add(dst: *MountStats, src: *const MountStats) void {
+    inline for (std.meta.fields(MountStats)) |f| {
+        @field(dst, f.name) += @field(src, f.name);
     }
 }
 
-// --- Recursive node application ---
-fn mm_apply_node_recursive(ctx: *MagicMount, allocator: Allocator, base: [*:0]const u8, wbase: [*:0]const u8, node: *ModuleTree.Node, has_tmpfs: bool) !void {
-    var path_buf: [PATH_MAX]u8 = undefined;
-    var wpath_buf: [PATH_MAX]u8 = undefined;
-    const path = Utils.path_join(allocator, &path_buf, base, node.name) catch return;
-    const wpath = Utils.path_join(allocator, &wpath_buf, wbase, node.name) catch return;
+fn mm_run_task(ap: *Applier, ex: *Executor, task: *ApplyTask) void {
+    const allocator = ex.allocator;
+    ap.reset();
+    ap.partition = task.job.node.name;
+    ap.minimise = task.job.minimise;
 
-    switch (node.type) {
-        .REGULAR => try mm_apply_regular_file(ctx, path, wpath, node, has_tmpfs),
-        .SYMLINK => try mm_apply_symlink(ctx, allocator, path, wpath, node),
-        .WHITEOUT => {
-            LOG(LOG_DEBUG, "whiteout {s}", .{path});
-            ctx.stats.nodes_whiteout += 1;
-        },
-        .DIRECTORY => {
-            var create_tmp = (!has_tmpfs and node.replace and node.module_path != null);
-            if (!has_tmpfs and !create_tmp) {
-                create_tmp = mm_check_need_tmpfs(node, path);
+    var wbase = Utils.PathBuf.init(ex.tmp_dir) catch |err| {
+        task.err = err;
+        return;
+    };
+    if (wbase.push(std.mem.trimLeft(u8, task.base, "/"))) |_| {
+        mm_apply_tree(ap, task.node, task.base, wbase.slice(), false, task.parent_fd) catch |err| {
+            task.err = err;
+        };
+    } else |err| {
+        task.err = err;
+    }
+
+    if (task.err != null) {
+        task.err_name = allocator.dupe(u8, task.node.name) catch null;
+        if (task.node.module_name) |mn| task.err_module = allocator.dupe(u8, mn) catch null;
+    }
+
+    const failed = allocator.alloc([]u8, ap.failed.items.len) catch return;
+    var n: usize = 0;
+    for (ap.failed.items) |name| {
+        failed[n] = allocator.dupe(u8, name) catch continue;
+        n += 1;
+    }
+    task.failed = failed[0..n];
+    task.failures = ap.failures.toOwnedSlice() catch &.{};
+}
+
+fn mm_worker(ex: *Executor) void {
+    var work = WorkDir.init(ex.allocator, ex.tmp_dir) catch |err| {
+        ex.mutex.lock();
+        defer ex.mutex.unlock();
+        if (ex.setup_err == null) ex.setup_err = err;
+        return;
+    };
+    // drop every cached dirfd before the workdir is detached
+    defer work.deinit();
+
+    var ap = Applier.init(ex.ctx, ex.allocator, &work);
+    defer ap.deinit();
+
+    while (ex.take()) |task| {
+        mm_run_task(&ap, ex, task);
+        ex.done(task);
+    }
+
+    ap.stats.selcon_relabels += @intCast(work.selcon.relabels);
+    ap.stats.selcon_skipped += @intCast(work.selcon.relabels_skipped);
+
+    ex.mutex.lock();
+    defer ex.mutex.unlock();
+    mm_stats_add(&ex.stats, &ap.stats);
+    ex.log.absorb(&ap.log) catch {};
+    ex.index.absorb(&ap.index) catch {};
+    ex.unmountable.appendSlice(ap.unmountable.items) catch return;
+    // ownership moved to the executor
+    ap.unmountable.clearRetainingCapacity();
+}
+
+fn mm_thread_count(ctx: *const MagicMount) usize {
+    const want: usize = if (ctx.apply_threads > 0)
+        @intCast(ctx.apply_threads)
+    else
+        @min(std.Thread.getCpuCount() catch 1, MAX_AUTO_THREADS);
+    return @max(1, want);
+}
+
+// Tree builder callback: hand a finished partition to the executor.
+fn mm_on_partition(ptr: *anyopaque, part: *ModuleTree.Node) void {
+    const ex: *Executor = @ptrCast(@alignCast(ptr));
+    // submit() has logged and freed the partition on error
+    ex.submit(part) catch {
+        ex.plan.stats.nodes_fail += 1;
+    };
+}
+
+// Merge per-task failures in plan order; the failed nodes move to `failures`.
+fn mm_report_tasks(ctx: *MagicMount, allocator: Allocator, tasks: []*ApplyTask, failures: *ArrayList(Report.Failure)) void {
+    var errors: usize = 0;
+    for (tasks) |task| {
+        for (task.failed) |name| {
+            ModuleTree.module_mark_failed(ctx, allocator, name) catch {};
+            allocator.free(name);
+        }
+        allocator.free(task.failed);
+
+        for (task.failures) |f| {
+            failures.append(f) catch Report.free_failure(allocator, f);
+        }
+        allocator.free(task.failures);
+
+        if (task.err) |err| {
+            const mn = task.err_module orelse "none";
+            LOG(LOG_ERROR, "child {s}/{s} failed: {s} (module: {s})", .{ task.base, task.err_name orelse "?", @errorName(err), mn });
+            if (task.err_module) |name| ModuleTree.module_mark_failed(ctx, allocator, name) catch {};
+            mm_task_failure(allocator, task, err, failures);
+            ctx.stats.nodes_fail += 1;
+            errors += 1;
+        }
+        if (task.err_name) |n| allocator.free(n);
+        if (task.err_module) |n| allocator.free(n);
+    }
+    if (errors > 0) LOG(LOG_ERROR, "{d} of {d} subtrees failed", .{ errors, tasks.len });
+}
+
+fn mm_task_failure(allocator: Allocator, task: *const ApplyTask, err: anyerror, failures: *ArrayList(Report.Failure)) void {
+    const path = std.fs.path.join(allocator, &.{ task.base, task.err_name orelse "?" }) catch return;
+    const module = if (task.err_module) |m| allocator.dupe(u8, m) catch null else null;
+    const f: Report.Failure = .{ .path = path, .module = module, .reason = @errorName(err) };
+    failures.append(f) catch Report.free_failure(allocator, f);
+}
+
+// --- Incremental apply ---
+//
+// `mmd apply --incremental` diffs against the units the previous run
+// recorded instead of replacing it. Partitions are cut down to single units,
+// but never below a previous unit, whose live listing is still the old
+// overlay; a unit whose digest is unchanged and whose mounts are all still
+// in place is kept, every other one is applied. Before a partition's tasks are
+// queued, its previous mounts that were not kept are detached, deepest
+// first; partitions gone from the plan entirely are detached at the end.
+const Baseline = struct {
+    ctx: *const MagicMount,
+    prev: MountLog,
+    mi: MountInfo,
+    mark_buf: [16]u8 = undefined,
+    // per previous record: carried over or detached
+    handled: []bool,
+    // paths of the units kept, pointing into `prev`
+    kept: ArrayList([]const u8),
+    // previous mounts detach() could not take down, still live
+    left: MountLog,
+    detached: usize = 0,
+    left_in_place: usize = 0,
+
+    const Keep = struct { unit: *const MountUnit, span: MountSpan };
+
+    fn load(ctx: *const MagicMount, allocator: Allocator, records_path: []const u8) ?Baseline {
+        var prev = MountLog.load(allocator, records_path) catch |err| {
+            LOG(LOG_WARN, "incremental: read {s}: {s}, applying everything", .{ records_path, @errorName(err) });
+            return null;
+        };
+        var mi = MountInfo.load(allocator) catch |err| {
+            LOG(LOG_WARN, "incremental: read mountinfo: {s}, applying everything", .{@errorName(err)});
+            prev.deinit();
+            return null;
+        };
+        const handled = allocator.alloc(bool, prev.records.items.len) catch {
+            mi.deinit();
+            prev.deinit();
+            return null;
+        };
+        @memset(handled, false);
+        return .{
+            .ctx = ctx,
+            .prev = prev,
+            .mi = mi,
+            .handled = handled,
+            .kept = ArrayList([]const u8).init(allocator),
+            .left = MountLog.init(allocator),
+        };
+    }
+
+    fn deinit(self: *Baseline) void {
+        self.left.deinit();
+        self.kept.deinit();
+        self.prev.allocator.free(self.handled);
+        self.mi.deinit();
+        self.prev.deinit();
+    }
+
+    fn mark(self: *Baseline) []const u8 {
+        return run_mark(&self.mark_buf, self.prev.run_id);
+    }
+
+    // The unit at `path` and the range of its previous records, if it is
+    // unchanged and everything mounted at or below it is still in place.
+    // Like detach(), only called from the scanner thread, so it needs no
+    // lock; only carry()'s `out` is shared with the workers.
+    fn unchanged(self: *Baseline, path: []const u8, digest: u64) ?Keep {
+        const u = self.prev.find_unit(path) orelse return null;
+        if (u.digest != digest) return null;
+
+        const span = self.prev.covered(path);
+        for (self.prev.records.items[span.lo..span.hi], span.lo..) |*r, i| {
+            if (self.handled[i]) return null;
+            if (Verify.identify(&self.mi, r, self.mark())) |why| {
+                LOG(LOG_DEBUG, "incremental: {s} changed under us: {s}", .{ r.path, why });
+                return null;
             }
-            const now_tmp = has_tmpfs or create_tmp;
+        }
+        return .{ .unit = u, .span = span };
+    }
 
-            if (now_tmp) try mm_setup_dir_tmpfs(path, wpath, node);
+    // Carry a unit unchanged() accepted over into `out`.
+    fn carry(self: *Baseline, keep: Keep, out: *MountLog) void {
+        for (self.prev.records.items[keep.span.lo..keep.span.hi], keep.span.lo..) |r, i| {
+            self.handled[i] = true;
+            out.add(r.path, r.source, r.kind, r.module, r.partition) catch {};
+        }
+        out.add_unit(keep.unit.path, keep.unit.digest) catch {};
+        self.kept.append(keep.unit.path) catch {};
+    }
 
-            if (create_tmp) {
-                try linux.mount(wpath, wpath, null, linux.MS_BIND, null);
+    // Detach the previous mounts of `partition` (all partitions if null)
+    // that were not kept, and drop the try-umount entries of those detached.
+    // The ones left in place (covered, replaced, or failing to unmount) go
+    // to `left` with their units, so the new record file still has them.
+    fn detach(self: *Baseline, allocator: Allocator, partition: ?[]const u8) void {
+        var list = ArrayList(MountRecord).init(allocator);
+        defer list.deinit();
+
+        for (self.prev.records.items, 0..) |r, i| {
+            if (self.handled[i]) continue;
+            if (partition) |p| {
+                if (!std.mem.eql(u8, r.partition, p)) continue;
             }
+            self.handled[i] = true;
+            list.append(r) catch continue;
+        }
+        if (list.items.len == 0) return;
+
+        const n = mm_detach_with(&self.mi, list.items, self.mark());
+        self.detached += n;
+        if (self.ctx.enable_unmountable) _ = unregister_units(allocator, &self.prev, list.items[0..n]);
 
-            try mm_process_dir_children(ctx, allocator, path, wpath, node, now_tmp);
-            try mm_process_remaining_children(ctx, allocator, path, wpath, node, now_tmp);
+        for (list.items[n..]) |r| {
+            self.left.add(r.path, r.source, r.kind, r.module, r.partition) catch {};
+            if (self.prev.find_unit(r.path)) |u| self.left.add_unit(u.path, u.digest) catch {};
+        }
+        self.left_in_place += list.items.len - n;
+    }
+};
 
-            if (create_tmp) {
-                _ = linux.mount(null, wpath, null, linux.MS_REMOUNT | linux.MS_BIND | linux.MS_RDONLY, null) catch {};
+// --- Try-umount registration ---
+//
+// The kernel walks the whole try-umount list on every app process spawn, so
+// it is kept short: candidates are collected during the apply, duplicates
+// and paths below an already listed mountpoint are dropped (unmounting the
+// ancestor detaches them too), and the rest is registered in one flush.
+// '/' sorts lowest, so /a, /a/x come before /a-b (see PathIndex.path_order)
+fn path_less(_: void, a: []u8, b: []u8) bool {
+    return PathIndex.path_order(a, b) == .lt;
+}
 
-                try linux.mount(wpath, path, null, linux.MS_MOVE, null);
-                LOG(LOG_INFO, "move mountpoint success: {s} -> {s}", .{ wpath, path });
-                _ = linux.mount(null, path, null, linux.MS_REC | linux.MS_PRIVATE, null) catch {};
+fn path_covers(ancestor: []const u8, path: []const u8) bool {
+    if (!std.mem.startsWith(u8, path, ancestor)) return false;
+    return path.len == ancestor.len or ancestor[ancestor.len - 1] == '/' or path[ancestor.len] == '/';
+}
 
-                if (ctx.enable_unmountable) {
-                    _ = Ksu.ksu_send_unmountable(path);
-                }
-            }
-            ctx.stats.nodes_mounted += 1;
-        },
+// Sorts `paths` and compacts it to the paths no other entry covers; the
+// dropped ones are freed. In component order an ancestor is directly
+// followed by everything below it, so one pass against the last kept path
+// is enough.
+fn mm_coalesce_unmountable(allocator: Allocator, paths: *ArrayList([]u8)) void {
+    std.sort.pdq([]u8, paths.items, {}, path_less);
+
+    var kept: usize = 0;
+    for (paths.items) |p| {
+        if (kept > 0 and path_covers(paths.items[kept - 1], p)) {
+            allocator.free(p);
+            continue;
+        }
+        paths.items[kept] = p;
+        kept += 1;
     }
+    paths.shrinkRetainingCapacity(kept);
 }
 
-// --- Main entry point ---
-pub fn magic_mount(ctx: *MagicMount, tmp_root: [*:0]const u8, allocator: Allocator) !i32 {
-    if (ctx == null) return -1;
+fn mm_flush_unmountable(ctx: *MagicMount, paths: *ArrayList([]u8)) void {
+    const candidates = paths.items.len;
+    mm_coalesce_unmountable(paths.allocator, paths);
 
-    const root = ModuleTree.build_mount_tree(ctx) orelse {
-        LOG(LOG_INFO, "no modules, magic_mount skipped", .{});
-        return 0;
+    const sent = Backend.get().register_unmountable(paths.items);
+    ctx.stats.umount_candidates += @intCast(candidates);
+    ctx.stats.umount_registered += @intCast(sent);
+    LOG(LOG_INFO, "try-umount ({s}): {d} candidates, {d} after coalescing, {d} registered", .{ Backend.get().name(), candidates, paths.items.len, sent });
+}
+
+// --- Workdir tmpfs sizing ---
+//
+// The tmpfs outlives the run through the directories moved out of it, so
+// its limits are what bounds the overlay's RAM. It is mounted without
+// transparent huge pages (a 2 MiB page per tiny file would dwarf the data)
+// and, once the apply is done and nothing more is written, remounted with
+// size and nr_inodes set to what is in use plus a little headroom.
+const TMPFS_OPTIONS = "mode=0755,huge=never";
+const TMPFS_HEADROOM_PCT = 10;
+const TMPFS_MIN_HEADROOM_KB = 256;
+const TMPFS_MIN_HEADROOM_INODES = 64;
+
+fn mm_mount_workdir(ctx: *const MagicMount, tmp_dir: []const u8) !void {
+    linux.mount(ctx.mount_source, tmp_dir, "tmpfs", 0, TMPFS_OPTIONS) catch |err| {
+        // kernels before 4.7 do not know huge=
+        if (err != error.InvalidArgument) return err;
+        LOG(LOG_DEBUG, "tmpfs rejected '{s}', mounting with defaults", .{TMPFS_OPTIONS});
+        try linux.mount(ctx.mount_source, tmp_dir, "tmpfs", 0, "mode=0755");
     };
-    defer ModuleTree.node_free(root);
+}
+
+fn mm_headroom(used: u64, min: u64) u64 {
+    return used + @max(used * TMPFS_HEADROOM_PCT / 100, min);
+}
+
+fn mm_shrink_workdir(ctx: *MagicMount, tmp_dir: []const u8) void {
+    const sfs = linux.statfs(tmp_dir) catch |err| {
+        LOG(LOG_WARN, "statfs {s}: {s}", .{ tmp_dir, @errorName(err) });
+        return;
+    };
+    const used_kb: u64 = (sfs.f_blocks - sfs.f_bfree) * sfs.f_bsize / 1024;
+    const used_inodes: u64 = sfs.f_files - sfs.f_ffree;
+    ctx.stats.tmpfs_used_kb = @intCast(used_kb);
+    ctx.stats.tmpfs_inodes = @intCast(used_inodes);
+
+    var buf: [128]u8 = undefined;
+    const opts = std.fmt.bufPrintZ(&buf, "size={d}k,nr_inodes={d}", .{
+        mm_headroom(used_kb, TMPFS_MIN_HEADROOM_KB),
+        mm_headroom(used_inodes, TMPFS_MIN_HEADROOM_INODES),
+    }) catch return;
+
+    linux.mount(null, tmp_dir, null, linux.MS_REMOUNT, opts) catch |err| {
+        LOG(LOG_WARN, "remount {s} with {s}: {s}", .{ tmp_dir, opts, @errorName(err) });
+        return;
+    };
+    LOG(LOG_INFO, "tmpfs: {d} KiB, {d} inodes in use, limits {s}", .{ used_kb, used_inodes, opts });
+}
+
+// --- Verification ---
+fn mm_verify(ctx: *MagicMount, allocator: Allocator, log: *const MountLog) void {
+    var mark_buf: [16]u8 = undefined;
+    const mark = run_mark(&mark_buf, ctx.run_id);
+    const res = Verify.run(allocator, log.records.items, mark, mm_thread_count(ctx)) catch |err| {
+        LOG(LOG_ERROR, "verify: read mountinfo: {s}", .{@errorName(err)});
+        return;
+    };
+    ctx.stats.verify_checked = @intCast(res.checked);
+    ctx.stats.verify_failed = @intCast(res.failed);
+    if (res.failed > 0) {
+        LOG(LOG_ERROR, "verify: {d} of {d} mounts not in place", .{ res.failed, res.checked });
+    } else {
+        LOG(LOG_INFO, "verify: all {d} mounts in place", .{res.checked});
+    }
+}
+
+// --- Path index ---
+//
+// Written next to the record file. A deferred stage adds to what the
+// critical stage wrote; an incremental run carries over the entries below
+// the units it kept.
+fn mm_save_index(allocator: Allocator, index: *PathIndex.Builder, tmp_root: [*:0]const u8, stage: ApplyStage, baseline: ?*Baseline) void {
+    var buf: [PATH_MAX]u8 = undefined;
+    const path = Utils.path_join(allocator, &buf, tmp_root, PathIndex.INDEX_FILE) catch return;
+
+    if (stage == .deferred or baseline != null) {
+        if (PathIndex.Index.open(path)) |old_index| {
+            var old = old_index;
+            defer old.close();
+            const under: ?[]const []const u8 = if (baseline) |b| b.kept.items else null;
+            index.keep(&old, under) catch |err| {
+                LOG(LOG_WARN, "carry over {s}: {s}", .{ path, @errorName(err) });
+            };
+        } else |err| {
+            LOG(LOG_WARN, "read {s}: {s}", .{ path, @errorName(err) });
+        }
+    }
+
+    index.save(path) catch |err| {
+        LOG(LOG_WARN, "write {s}: {s}", .{ path, @errorName(err) });
+        return;
+    };
+    LOG(LOG_DEBUG, "path index: {d} entries", .{index.items.items.len});
+}
+
+// --- Rerun detection ---
+//
+// Each run leaves its records in <tmp_root>/mounts under the module set
+// fingerprint and a run id its tmpfs dirs are marked with. A rerun with the
+// same fingerprint whose recorded mounts all check out in place has nothing
+// to do. Otherwise whatever of the previous mounts is still ours is detached,
+// deepest first, before the fresh apply, so reruns never stack.
+pub const RECORDS_FILE = "mounts";
+
+const Previous = enum { none, applied, replaced };
+
+pub fn run_mark(buf: *[16]u8, run_id: u64) []const u8 {
+    return std.fmt.bufPrint(buf, "{x:0>16}", .{run_id}) catch unreachable;
+}
+
+fn mm_check_previous(ctx: *MagicMount, allocator: Allocator, records_path: []const u8) Previous {
+    var prev = MountLog.load(allocator, records_path) catch |err| {
+        if (err != error.FileNotFound) LOG(LOG_WARN, "read {s}: {s}", .{ records_path, @errorName(err) });
+        return .none;
+    };
+    defer prev.deinit();
+    if (prev.records.items.len == 0) return .none;
+
+    var mark_buf: [16]u8 = undefined;
+    const mark = run_mark(&mark_buf, prev.run_id);
+
+    if (prev.fingerprint == ctx.fingerprint) {
+        const res = Verify.run(allocator, prev.records.items, mark, mm_thread_count(ctx)) catch |err| blk: {
+            LOG(LOG_WARN, "verify previous run: {s}", .{@errorName(err)});
+            break :blk Verify.Result{ .checked = prev.records.items.len, .failed = prev.records.items.len };
+        };
+        if (res.failed == 0) {
+            LOG(LOG_INFO, "modules unchanged and all {d} mounts of the previous run in place, nothing to apply", .{res.checked});
+            ctx.stats.mounts_added = @intCast(res.checked);
+            return .applied;
+        }
+        LOG(LOG_WARN, "{d} of {d} mounts of the previous run not in place, replacing it", .{ res.failed, res.checked });
+    } else {
+        LOG(LOG_INFO, "modules changed since the previous run, replacing its {d} mounts", .{prev.records.items.len});
+    }
+
+    const n = detach_records(allocator, prev.records.items, mark) catch |err| {
+        LOG(LOG_ERROR, "detach previous mounts: {s}", .{@errorName(err)});
+        return .replaced;
+    };
+    LOG(LOG_INFO, "detached {d} mounts of the previous run", .{n});
+    return .replaced;
+}
 
+/// Detaches the recorded mounts that are still ours, deepest first; a mount
+/// something else has since been stacked on or replaced is left alone.
+/// Returns n: records[0..n] were detached, the rest are still mounted.
+/// Drops the try-umount entries of `detached` and returns how many went.
+/// Only units (binds outside any tmpfs, and the tmpfs dirs) were ever
+/// registered.
+pub fn unregister_units(allocator: Allocator, log: *const MountLog, detached: []const MountRecord) usize {
+    var units = ArrayList([]u8).init(allocator);
+    defer units.deinit();
+    for (detached) |r| {
+        if (log.find_unit(r.path) != null) units.append(r.path) catch {};
+    }
+    if (units.items.len == 0) return 0;
+    return Backend.get().unregister_unmountable(units.items);
+}
+
+pub fn detach_records(allocator: Allocator, records: []MountRecord, mark: ?[]const u8) !usize {
+    var mi = try MountInfo.load(allocator);
+    defer mi.deinit();
+    return mm_detach_with(&mi, records, mark);
+}
+
+fn mm_detach_with(mi: *const MountInfo, records: []MountRecord, mark: ?[]const u8) usize {
+    std.sort.pdq(MountRecord, records, {}, mm_record_deeper);
+
+    var buf: [PATH_MAX]u8 = undefined;
+    var n: usize = 0;
+    for (records, 0..) |*r, i| {
+        if (Verify.identify(mi, r, mark)) |why| {
+            LOG(LOG_DEBUG, "keep {s}: {s}", .{ r.path, why });
+            continue;
+        }
+        if (r.path.len >= buf.len) continue;
+        @memcpy(buf[0..r.path.len], r.path);
+        buf[r.path.len] = 0;
+        linux.umount2(buf[0..r.path.len :0], linux.MNT_DETACH) catch |err| {
+            LOG(LOG_WARN, "umount {s}: {s}", .{ r.path, @errorName(err) });
+            continue;
+        };
+        // the detached ones gather at the front
+        std.mem.swap(MountRecord, &records[n], &records[i]);
+        n += 1;
+    }
+    return n;
+}
+
+// reverse path order puts every path before its parents
+fn mm_record_deeper(_: void, a: MountRecord, b: MountRecord) bool {
+    return std.mem.lessThan(u8, b.path, a.path);
+}
+
+// --- Main entry point ---
+pub fn magic_mount(ctx: *MagicMount, tmp_root: [*:0]const u8, allocator: Allocator) !i32 {
     var tmp_dir_buf: [PATH_MAX]u8 = undefined;
     const tmp_dir = Utils.path_join(allocator, &tmp_dir_buf, tmp_root, "workdir") catch return -1;
 
+    var records_buf: [PATH_MAX]u8 = undefined;
+    const records_path = Utils.path_join(allocator, &records_buf, tmp_root, RECORDS_FILE) catch return -1;
+
+    const stage: ApplyStage = @enumFromInt(ctx.apply_stage);
+
+    var report = Report.Run.init(allocator);
+    defer report.deinit();
+    var lap = Report.Lap.start();
+    errdefer mm_write_report(&report, &lap, tmp_root, ctx, -1);
+
+    ctx.fingerprint = ModuleTree.modules_fingerprint(ctx, allocator) catch |err| blk: {
+        LOG(LOG_WARN, "module fingerprint: {s}", .{@errorName(err)});
+        break :blk 0;
+    };
+
+    var baseline: ?Baseline = null;
+    defer if (baseline) |*b| b.deinit();
+    if (ctx.incremental and stage == .all) baseline = Baseline.load(ctx, allocator, records_path);
+
+    if (baseline) |*b| {
+        // kept tmpfs dirs carry the previous mark, new ones have to match
+        ctx.run_id = b.prev.run_id;
+    } else if (stage != .deferred) {
+        // the deferred stage always follows a critical stage of this process
+        ctx.run_id = std.crypto.random.int(u64);
+        if (ctx.fingerprint != 0 and mm_check_previous(ctx, allocator, records_path) == .applied) {
+            ctx.stats.already_applied = 1;
+            report.phases.prepare = lap.lap();
+            mm_write_report(&report, &lap, tmp_root, ctx, 0);
+            return 0;
+        }
+    }
+
+    report.phases.prepare = lap.lap();
+
     try Utils.mkdir_p(tmp_dir);
 
     LOG(LOG_INFO, "starting magic_mount core logic: tmpfs_source={s} tmp_dir={s}", .{ ctx.mount_source, tmp_dir });
 
-    try linux.mount(ctx.mount_source, tmp_dir, "tmpfs", 0, "");
+    // the workdir has to be up before the first partition is streamed in
+    try mm_mount_workdir(ctx, tmp_dir);
     _ = linux.mount(null, tmp_dir, null, linux.MS_REC | linux.MS_PRIVATE, null) catch {};
 
     var rc: i32 = 0;
-    mm_apply_node_recursive(ctx, allocator, "/", tmp_dir, root, false) catch |err| {
-        LOG(.{}, "mm_apply_node_recursive failed: {}", .{@errorName(err)});
-        ctx.stats.nodes_fail += 1;
-        rc = -1;
-    };
+    run: {
+        var real_root = RealDir.open(allocator, "/") catch |err| {
+            LOG(LOG_ERROR, "opendir /: {s}", .{@errorName(err)});
+            rc = -1;
+            break :run;
+        };
+        defer real_root.deinit();
+
+        var plan = ApplyPlan.init(allocator);
+        defer plan.deinit();
+
+        var ex = Executor.init(ctx, allocator, tmp_dir, &plan, &real_root);
+        defer ex.deinit();
+        if (baseline) |*b| ex.baseline = b;
+        ex.start(mm_thread_count(ctx));
+
+        const parts = ModuleTree.build_mount_tree_streaming(ctx, allocator, .{ .ptr = &ex, .emit = mm_on_partition }) catch |err| blk: {
+            LOG(LOG_ERROR, "build_mount_tree failed: {s}", .{@errorName(err)});
+            rc = -1;
+            break :blk 0;
+        };
+        const used = ex.finish();
+
+        if (baseline) |*b| {
+            // partitions no module touches any more
+            b.detach(allocator, null);
+            ex.log.absorb(&b.left) catch |err| {
+                LOG(LOG_WARN, "incremental: record mounts left in place: {s}", .{@errorName(err)});
+            };
+            LOG(LOG_INFO, "incremental: {d} units kept, {d} subtrees applied, {d} previous mounts detached, {d} left in place", .{
+                b.kept.items.len, plan.tasks.items.len, b.detached, b.left_in_place,
+            });
+        }
+
+        if (parts == 0 and rc == 0) {
+            LOG(LOG_INFO, "no modules, magic_mount skipped", .{});
+        } else {
+            // the root directory itself
+            plan.stats.nodes_mounted += 1;
+            LOG(LOG_INFO, "applied {d} partitions as {d} subtrees on {d} thread(s)", .{ parts, plan.tasks.items.len, used });
+        }
+
+        mm_stats_add(&ctx.stats, &plan.stats);
+        mm_stats_add(&ctx.stats, &ex.stats);
+        ctx.stats.partitions = @intCast(parts);
+        ctx.stats.subtrees = @intCast(plan.tasks.items.len);
+        ctx.stats.threads_used = @intCast(used);
+        mm_report_tasks(ctx, allocator, plan.tasks.items, &report.failures);
+
+        ex.log.sort();
+        ctx.stats.mounts_added = @intCast(ex.log.records.items.len);
+        ex.log.report(ctx.max_mounts);
+        report.count_mounts(&ex.log);
+        report.phases.apply = lap.lap();
+
+        if (ctx.verify) mm_verify(ctx, allocator, &ex.log);
+        report.phases.verify = lap.lap();
+
+        ex.log.fingerprint = ctx.fingerprint;
+        // with old mounts left in place this is not the module set's apply,
+        // so a rerun must not count it as applied
+        if (baseline) |*b| {
+            if (b.left_in_place > 0) ex.log.fingerprint = 0;
+        }
+        ex.log.run_id = ctx.run_id;
+        ex.log.save(records_path, stage == .deferred) catch |err| {
+            LOG(LOG_WARN, "write {s}: {s}", .{ records_path, @errorName(err) });
+        };
+
+        const kept: ?*Baseline = if (baseline) |*b| b else null;
+        mm_save_index(allocator, &ex.index, tmp_root, stage, kept);
+        report.phases.record = lap.lap();
+
+        if (ctx.enable_unmountable) mm_flush_unmountable(ctx, &ex.unmountable);
+        report.phases.umount = lap.lap();
+
+        // before the detach: the moved mounts keep this superblock alive
+        mm_shrink_workdir(ctx, tmp_dir);
+
+        if (ex.setup_err) |err| {
+            LOG(LOG_ERROR, "open workdir {s}: {s}", .{ tmp_dir, @errorName(err) });
+            ctx.stats.nodes_fail += 1;
+            rc = -1;
+        }
+    }
 
     _ = linux.umount2(tmp_dir, linux.MNT_DETACH) catch |err| {
         LOG(LOG_ERROR, "umount {s}: {s}", .{ tmp_dir, @errorName(err) });
     };
 
     _ = os.rmdir(tmp_dir) catch {};
+    report.phases.cleanup = lap.lap();
 
+    mm_write_report(&report, &lap, tmp_root, ctx, rc);
     return rc;
 }
 
+fn mm_write_report(report: *Report.Run, lap: *const Report.Lap, tmp_root: [*:0]const u8, ctx: *const MagicMount, rc: i32) void {
+    report.phases.total = lap.total();
+    report.write(std.mem.sliceTo(tmp_root, 0), ctx, rc) catch |err| {
+        LOG(LOG_WARN, "write {s}: {s}", .{ Report.REPORT_FILE, @errorName(err) });
+    };
+}
+
 // Allow C linkage if needed
 pub export fn c_magic_mount(ctx: *MagicMount, tmp_root: [*:0]const u8) c_int {
     const rc = magic_mount(ctx, tmp_root, std.heap.page_allocator) catch return -1;
@@ -5,18 +5,20 @@ const Allocator = std.mem.Allocator;
 const MagicMount = @import("magic_mount.zig");
 const ModuleTree = @import("module_tree.zig");
 const Utils = @import("utils.zig");
+const Prefetch = @import("prefetch.zig").Prefetch;
+const Backend = @import("backend.zig");
+const Commands = @import("commands.zig");
+const Watch = @import("watch.zig");
+const Status = @import("status.zig");
+const ConfigFile = @import("config.zig");
+const Config = ConfigFile.Config;
+const load_config_file = ConfigFile.load_config_file;
 
 const VERSION = "1.0.0"; // Replace with your version or @embedFile("VERSION")
 
-const Config = struct {
-    module_dir: ?[]const u8 = null,
-    temp_dir: ?[]const u8 = null,
-    mount_source: ?[]const u8 = null,
-    log_file: ?[]const u8 = null,
-    partitions: ?[]const u8 = null,
-    debug: bool = false,
-    umount: bool = true,
-};
+const KSUD_PATH = "/data/adb/ksud";
+
+const DEFAULT_CRITICAL_PARTS = "system,vendor";
 
 fn usage(prog: []const u8) void {
     const stderr = std.io.getStdErr().writer();
@@ -24,6 +26,9 @@ fn usage(prog: []const u8) void {
         \\Magic Mount: {s}
         \\
         \\Usage: {s} [options]
+        \\       {s} apply [options] [--incremental]
+        \\       {s} watch [options]
+        \\       {s} <command> [-c FILE] [-t DIR] [--backend NAME] [-v]
         \\
         \\Options:
         \\  -m, --module-dir DIR      Module directory (default: {s})
@@ -32,71 +37,31 @@ fn usage(prog: []const u8) void {
         \\  -p, --partitions LIST     Extra partitions (eg. mi_ext,my_stock)
         \\  -l, --log-file FILE       Log file (default: stderr, '-' for stdout)
         \\  -c, --config FILE         Config file (default: {s})
+        \\  -j, --jobs N              Apply worker threads (default: 0 = auto)
         \\  -v, --verbose             Enable debug logging
         \\      --no-umount           Disable umount
+        \\      --no-prefetch         Do not warm up module and partition caches
+        \\      --early-notify        Exit once critical partitions are mounted,
+        \\                            finish the rest in the background
+        \\      --no-notify           Do not report the module-mounted event
+        \\      --backend NAME        Root backend: ksu, none or fake (default: ksu)
+        \\      --verify              Check every mount against mountinfo afterwards
+        \\      --incremental         apply only: keep what the last run mounted
+        \\                            and is unchanged, redo the rest
+        \\                            (watch: always, after every module change)
         \\  -h, --help                Show this help message
         \\
     , .{
         VERSION,
         prog,
+        prog,
+        prog,
+        prog,
         MagicMount.DEFAULT_MODULE_DIR,
         MagicMount.DEFAULT_MOUNT_SOURCE,
-        "/data/adb/magic_mount/mm.conf",
+        ConfigFile.DEFAULT_PATH,
     }) catch {};
-}
-
-fn load_config_file(allocator: Allocator, path: []const u8, cfg: *Config, _ctx: *MagicMount.MagicMount) !void {
-    _ = _ctx;
-    var file = std.fs.cwd().openFile(path, .{}) catch |err| {
-        if (err != error.FileNotFound) {
-            Utils.LOGW("config file {s}: {s}", .{ path, @errorName(err) });
-        }
-        return;
-    };
-    defer file.close();
-
-    Utils.LOGI("Loading config file: {s}", .{path});
-
-    var buf: [1024]u8 = undefined;
-    var line_num: usize = 0;
-
-    var stream = std.io.bufferedReader(file.reader());
-    var reader = stream.reader();
-
-    while (try reader.readUntilDelimiterOrEof(&buf, '\n')) |line| {
-        line_num += 1;
-
-        var trimmed = Utils.str_trim(line);
-        if (trimmed.len == 0 or trimmed[0] == '#') continue;
-
-        const eq_index = std.mem.indexOfScalar(u8, trimmed, '=') orelse {
-            Utils.LOGW("config:{d}: invalid line (no '=')", .{line_num});
-            continue;
-        };
-
-        const key = Utils.str_trim(trimmed[0..eq_index]);
-        const val = Utils.str_trim(trimmed[eq_index + 1 ..]);
-
-        if (key.len == 0 or val.len == 0) continue;
-
-        if (std.ascii.eqlIgnoreCase(key, "module_dir")) {
-            cfg.module_dir = try allocator.dupe(u8, val);
-        } else if (std.ascii.eqlIgnoreCase(key, "temp_dir")) {
-            cfg.temp_dir = try allocator.dupe(u8, val);
-        } else if (std.ascii.eqlIgnoreCase(key, "mount_source")) {
-            cfg.mount_source = try allocator.dupe(u8, val);
-        } else if (std.ascii.eqlIgnoreCase(key, "log_file")) {
-            cfg.log_file = try allocator.dupe(u8, val);
-        } else if (std.ascii.eqlIgnoreCase(key, "debug")) {
-            cfg.debug = Utils.str_is_true(val);
-        } else if (std.ascii.eqlIgnoreCase(key, "umount")) {
-            cfg.umount = Utils.str_is_true(val);
-        } else if (std.ascii.eqlIgnoreCase(key, "partitions")) {
-            cfg.partitions = try allocator.dupe(u8, val);
-        } else {
-            Utils.LOGW("config:{d}: unknown key '{s}'", .{ line_num, key });
-        }
-    }
+    Commands.usage_commands(stderr);
 }
 
 fn parse_partitions(allocator: Allocator, list: []const u8, ctx: *MagicMount.MagicMount) !void {
@@ -117,27 +82,98 @@ fn parse_partitions(allocator: Allocator, list: []const u8, ctx: *MagicMount.Mag
     }
 }
 
-fn setup_logging(_allocator: Allocator, log_path: []const u8) !?std.fs.File {
+// Plain comma/space separated partition names, no registration checks.
+fn parse_name_list(allocator: Allocator, list: []const u8, out: *std.ArrayList([]u8)) !void {
+    var it = std.mem.tokenizeAny(u8, list, ", \t");
+    while (it.next()) |token| {
+        const name = std.mem.trim(u8, token, "/");
+        if (name.len == 0) continue;
+        try out.append(try allocator.dupe(u8, name));
+    }
+}
+
+fn setup_logging(_allocator: Allocator, log_path: []const u8, rotate: bool) !?std.fs.File {
     _ = _allocator;
     if (std.mem.eql(u8, log_path, "-")) {
         return null; // Use stdout (handled by logSetFile(null))
     }
 
-    const file = std.fs.cwd().openFile(log_path, .{ .mode = .append }) catch |err| {
+    if (rotate) rotate_log(log_path);
+
+    const file = std.fs.cwd().createFile(log_path, .{ .truncate = false }) catch |err| {
         std.debug.print("Error: Cannot open log file {s}: {s}\n", .{ log_path, @errorName(err) });
         return err;
     };
+    file.seekFromEnd(0) catch {};
     return file;
 }
 
-fn print_summary(ctx: *const MagicMount.MagicMount) void {
-    Utils.LOGI("Summary", .{});
+// Keep the previous run's log as <log>.old, one generation only.
+fn rotate_log(log_path: []const u8) void {
+    var buf: [Utils.PATH_MAX]u8 = undefined;
+    const old = std.fmt.bufPrint(&buf, "{s}.old", .{log_path}) catch return;
+    std.fs.cwd().rename(log_path, old) catch |err| {
+        if (err != error.FileNotFound) {
+            std.debug.print("Warning: Cannot rotate log file {s}: {s}\n", .{ log_path, @errorName(err) });
+        }
+    };
+}
+
+// Tell the root implementation that modules are mounted. The KSU driver
+// ioctl needs no new process; ksud is only spawned if the driver refuses it.
+fn notify_mounted(allocator: Allocator) void {
+    const backend = Backend.get();
+    if (backend.notify_mounted()) return;
+    if (backend.kind != .ksu) {
+        Utils.LOGE("notify-module-mounted: {s} backend failed", .{backend.name()});
+        return;
+    }
+
+    Utils.LOGW("falling back to {s} kernel notify-module-mounted", .{KSUD_PATH});
+    var child = std.process.Child.init(&.{ KSUD_PATH, "kernel", "notify-module-mounted" }, allocator);
+    const term = child.spawnAndWait() catch |err| {
+        Utils.LOGE("notify-module-mounted: {s}", .{@errorName(err)});
+        return;
+    };
+    if (term != .Exited or term.Exited != 0) {
+        Utils.LOGE("notify-module-mounted: ksud exited abnormally", .{});
+    }
+}
+
+fn print_summary(ctx: *const MagicMount.MagicMount, title: []const u8) void {
+    Utils.LOGI("{s}", .{title});
+    if (ctx.stats.already_applied != 0) {
+        Utils.LOGI("Already applied:       {d} mounts of the previous run in place", .{ctx.stats.mounts_added});
+        return;
+    }
     Utils.LOGI("Modules processed:     {d}", .{ctx.stats.modules_total});
     Utils.LOGI("Nodes total:           {d}", .{ctx.stats.nodes_total});
     Utils.LOGI("Nodes mounted:         {d}", .{ctx.stats.nodes_mounted});
     Utils.LOGI("Nodes skipped:         {d}", .{ctx.stats.nodes_skipped});
     Utils.LOGI("Whiteouts:             {d}", .{ctx.stats.nodes_whiteout});
     Utils.LOGI("Failures:              {d}", .{ctx.stats.nodes_fail});
+    Utils.LOGI("SELinux relabels:      {d} (skipped {d})", .{ ctx.stats.selcon_relabels, ctx.stats.selcon_skipped });
+    if (ctx.stats.inline_files > 0) {
+        Utils.LOGI("Inline copies:         {d} files, {d} KiB of tmpfs for {d} fewer mounts", .{
+            ctx.stats.inline_files,
+            @divTrunc(ctx.stats.inline_bytes + 1023, 1024),
+            ctx.stats.inline_files,
+        });
+    }
+    if (ctx.max_mounts > 0) {
+        Utils.LOGI("Mounts added:          {d} (budget {d})", .{ ctx.stats.mounts_added, ctx.max_mounts });
+    } else {
+        Utils.LOGI("Mounts added:          {d}", .{ctx.stats.mounts_added});
+    }
+    Utils.LOGI("Tmpfs usage:           {d} KiB, {d} inodes", .{ ctx.stats.tmpfs_used_kb, ctx.stats.tmpfs_inodes });
+    Utils.LOGI("Try-umount entries:    {d} (from {d} candidates)", .{ ctx.stats.umount_registered, ctx.stats.umount_candidates });
+    if (ctx.verify) {
+        if (ctx.stats.verify_failed > 0) {
+            Utils.LOGE("Verify:                {d} of {d} mounts not in place", .{ ctx.stats.verify_failed, ctx.stats.verify_checked });
+        } else {
+            Utils.LOGI("Verify:                {d} mounts in place", .{ctx.stats.verify_checked});
+        }
+    }
 
     const failed = ctx.failed_modules orelse {
         Utils.LOGI("No module failures", .{});
@@ -162,10 +198,20 @@ pub fn main() !u8 {
     // Initialize logging early
     Utils.logInit(allocator);
 
-    var args = try std.process.argsAlloc(allocator);
-    defer std.process.argsFree(allocator, args);
+    const all_args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, all_args);
+
+    const prog = if (all_args.len > 0) all_args[0] else "magic_mount";
+
+    if (Commands.find(all_args)) |cmd| return Commands.run(allocator, cmd, all_args);
 
-    const prog = if (args.len > 0) args[0] else "magic_mount";
+    // `mmd apply` is the boot apply run by hand: it appends to the boot log
+    // instead of rotating it and does not tell the root implementation
+    // anything, boot is long over. `mmd watch` is the same, repeated.
+    const mode: []const u8 = if (all_args.len > 1) all_args[1] else "";
+    const watch = std.mem.eql(u8, mode, "watch");
+    const manual = watch or std.mem.eql(u8, mode, "apply");
+    const args = if (manual) all_args[1..] else all_args;
 
     var ctx: MagicMount.MagicMount = .{
         .module_dir = null,
@@ -174,12 +220,24 @@ pub fn main() !u8 {
         .failed_modules = null,
         .extra_parts = null,
         .enable_unmountable = true,
+        .apply_threads = 0,
+        .inline_copy_kb = 0,
+        .max_mounts = 0,
+        .partition_order = null,
+        .critical_parts = null,
+        .apply_stage = 0,
+        .verify = false,
+        .fingerprint = 0,
+        .run_id = 0,
+        .incremental = false,
     };
     MagicMount.magic_mount_init(&ctx);
 
     // Initialize string lists
     ctx.failed_modules = std.ArrayList([]u8).init(allocator);
     ctx.extra_parts = std.ArrayList([]u8).init(allocator);
+    ctx.partition_order = std.ArrayList([]u8).init(allocator);
+    ctx.critical_parts = std.ArrayList([]u8).init(allocator);
     defer ModuleTree.module_tree_cleanup(&ctx, allocator);
 
     var cfg: Config = .{ .umount = true };
@@ -187,7 +245,9 @@ pub fn main() !u8 {
     var tmp_dir: ?[]const u8 = null;
     var cli_log_path: ?[]const u8 = null;
     var cli_has_partitions = false;
-    var config_path: []const u8 = "/data/adb/magic_mount/mm.conf";
+    var config_path: []const u8 = ConfigFile.DEFAULT_PATH;
+    var cli_module_dir: ?[]const u8 = null;
+    var cli_prefetch = true;
 
     // First pass: get config path and log file
     var i: usize = 1;
@@ -203,21 +263,35 @@ pub fn main() !u8 {
             i += 2;
             continue;
         }
+        if ((std.mem.eql(u8, arg, "-m") or std.mem.eql(u8, arg, "--module-dir")) and i + 1 < args.len) {
+            cli_module_dir = args[i + 1];
+            i += 2;
+            continue;
+        }
+        if (std.mem.eql(u8, arg, "--no-prefetch")) cli_prefetch = false;
         i += 1;
     }
 
+    // Warm the caches while the config is parsed; a module_dir set only in
+    // the config file is not known yet, so this uses the default then.
+    var prefetch: ?*Prefetch = if (cli_prefetch)
+        Prefetch.start(allocator, cli_module_dir orelse MagicMount.DEFAULT_MODULE_DIR)
+    else
+        null;
+    defer if (prefetch) |pf| pf.finish();
+
     // Setup CLI log file
     if (cli_log_path) |path| {
-        const log_file = try setup_logging(allocator, path);
+        const log_file = try setup_logging(allocator, path, !manual);
         Utils.logSetFile(log_file);
     }
 
     // Load config
-    try load_config_file(allocator, config_path, &cfg, &ctx);
+    try load_config_file(allocator, config_path, &cfg);
 
     // Setup config log file (if no CLI override)
     if (cli_log_path == null and cfg.log_file) |path| {
-        const log_file = try setup_logging(allocator, path);
+        const log_file = try setup_logging(allocator, path, !manual);
         Utils.logSetFile(log_file);
     }
 
@@ -227,6 +301,13 @@ pub fn main() !u8 {
     if (cfg.temp_dir) tmp_dir = cfg.temp_dir;
     if (cfg.debug) Utils.logSetLevel(.debug);
     ctx.enable_unmountable = cfg.umount;
+    if (!cfg.prefetch) {
+        if (prefetch) |pf| pf.cancel();
+    }
+    if (cfg.threads) |n| ctx.apply_threads = n;
+    if (cfg.inline_copy_kb) |kb| ctx.inline_copy_kb = @max(kb, 0);
+    if (cfg.max_mounts) |n| ctx.max_mounts = @max(n, 0);
+    ctx.verify = cfg.verify;
 
     // Second pass: handle all args
     var j: usize = 1;
@@ -248,6 +329,43 @@ pub fn main() !u8 {
             continue;
         }
 
+        if (std.mem.eql(u8, arg, "--no-prefetch")) continue;
+
+        if (std.mem.eql(u8, arg, "--early-notify")) {
+            cfg.early_notify = true;
+            continue;
+        }
+
+        if (std.mem.eql(u8, arg, "--verify")) {
+            ctx.verify = true;
+            continue;
+        }
+
+        if (std.mem.eql(u8, arg, "--no-notify")) {
+            cfg.notify = false;
+            continue;
+        }
+
+        if (std.mem.eql(u8, arg, "--incremental") and manual) {
+            ctx.incremental = true;
+            continue;
+        }
+
+        if (std.mem.eql(u8, arg, "--backend")) {
+            if (j + 1 >= args.len) {
+                std.debug.print("Error: Missing value for {s}\n", .{arg});
+                usage(prog);
+                return error.MissingArgument;
+            }
+            j += 1;
+            cfg.backend = Backend.parse_kind(args[j]) orelse {
+                std.debug.print("Error: Unknown backend: {s}\n", .{args[j]});
+                usage(prog);
+                return 1;
+            };
+            continue;
+        }
+
         if (std.mem.eql(u8, arg, "-c") or std.mem.eql(u8, arg, "--config") or
             std.mem.eql(u8, arg, "-l") or std.mem.eql(u8, arg, "--log-file"))
         {
@@ -288,6 +406,21 @@ pub fn main() !u8 {
             continue;
         }
 
+        if ((std.mem.eql(u8, arg, "-j") or std.mem.eql(u8, arg, "--jobs"))) {
+            if (j + 1 >= args.len) {
+                std.debug.print("Error: Missing value for {s}\n", .{arg});
+                usage(prog);
+                return error.MissingArgument;
+            }
+            j += 1;
+            ctx.apply_threads = std.fmt.parseInt(i32, args[j], 10) catch {
+                std.debug.print("Error: Invalid value for {s}: {s}\n", .{ arg, args[j] });
+                usage(prog);
+                return 1;
+            };
+            continue;
+        }
+
         if ((std.mem.eql(u8, arg, "-p") or std.mem.eql(u8, arg, "--partitions"))) {
             cli_has_partitions = true;
             if (j + 1 >= args.len) {
@@ -311,9 +444,29 @@ pub fn main() !u8 {
         try parse_partitions(allocator, list, &ctx);
     }
 
+    if (cfg.priority) |list| try parse_name_list(allocator, list, &ctx.partition_order.?);
+    try parse_name_list(allocator, cfg.critical orelse DEFAULT_CRITICAL_PARTS, &ctx.critical_parts.?);
+
+    var fake = Backend.Fake.init(allocator);
+    defer fake.deinit();
+    if (cfg.backend == .fake) {
+        fake.latency_us = cfg.fake_latency_us;
+        fake.record_path = cfg.fake_record;
+        Backend.set(fake.backend());
+    } else {
+        Backend.select(cfg.backend);
+    }
+
+    if (manual) {
+        cfg.notify = false;
+        cfg.early_notify = false;
+    }
+    if (watch) ctx.incremental = true;
+
     // Determine temp directory
     if (tmp_dir == null) {
-        const selected = Utils.select_auto_tempdir(&auto_tmp);
+        // a manual run has to find the boot run's state
+        const selected = if (manual) Commands.find_state_dir(&auto_tmp) else Utils.select_auto_tempdir(&auto_tmp);
         if (selected.len == 0) {
             Utils.LOGE("failed to determine temp directory", .{});
             return 1;
@@ -330,6 +483,7 @@ pub fn main() !u8 {
     Utils.LOGI("  Module directory:  {s}", .{ctx.module_dir orelse MagicMount.DEFAULT_MODULE_DIR});
     Utils.LOGI("  Temp directory:    {s}", .{tmp_dir.?});
     Utils.LOGI("  Mount source:      {s}", .{ctx.mount_source orelse MagicMount.DEFAULT_MOUNT_SOURCE});
+    Utils.LOGI("  Root backend:      {s}", .{Backend.get().name()});
     Utils.LOGI("  Log level:         {s}", .{if (@intFromEnum(Utils.g_log_level) >= @intFromEnum(Utils.LogLevel.debug)) "DEBUG" else "INFO"});
 
     if ((ctx.extra_parts orelse .{}).items.len > 0) {
@@ -339,10 +493,63 @@ pub fn main() !u8 {
         }
     }
 
+    if (cfg.early_notify) {
+        Utils.LOGI("  Critical stage:    {d} partitions", .{ctx.critical_parts.?.items.len});
+        for (ctx.critical_parts.?.items) |part| {
+            Utils.LOGI("    - {s}", .{part});
+        }
+        ctx.apply_stage = @intFromEnum(MagicMount.ApplyStage.critical);
+    }
+
+    if (watch) {
+        if (prefetch) |pf| {
+            pf.finish();
+            prefetch = null;
+        }
+        return watch_loop(&ctx, tmp_dir.?, allocator);
+    }
+
     // Run magic_mount
-    const rc = MagicMount.magic_mount(&ctx, tmp_dir.?, allocator) catch |err| {
-        Utils.LOGE("magic_mount failed: {s}", .{@errorName(err)});
+    if (prefetch) |pf| pf.consumer_started();
+    const rc = run_stage(&ctx, tmp_dir.?, allocator, if (cfg.early_notify) "Summary (critical stage)" else "Summary");
+    if (prefetch) |pf| {
+        pf.finish();
+        prefetch = null;
+    }
+
+    if (rc == 0 and cfg.notify) notify_mounted(allocator);
+    if (!cfg.early_notify) return if (rc == 0) 0 else 1;
+    // the previous run's mounts were kept, there is no second stage
+    if (ctx.stats.already_applied != 0) return 0;
+
+    if (rc != 0) {
+        // A failed subtree must not cost the other partitions their mounts.
+        // Boot was not notified, so there is nothing to hurry for: finish
+        // inline, as a single-stage run would have.
+        _ = finish_deferred(&ctx, tmp_dir.?, allocator);
         return 1;
+    }
+
+    // Two-stage run: boot has been notified, the child finishes the
+    // remaining partitions with its own report. Every worker thread has
+    // been joined by now, so forking is safe.
+    const pid = os.fork() catch |err| {
+        Utils.LOGW("fork for background stage failed: {s}, finishing inline", .{@errorName(err)});
+        return finish_deferred(&ctx, tmp_dir.?, allocator);
+    };
+    if (pid != 0) {
+        Utils.LOGI("critical partitions mounted, background stage pid {d}", .{pid});
+        return 0;
+    }
+
+    _ = os.linux.setsid();
+    return finish_deferred(&ctx, tmp_dir.?, allocator);
+}
+
+fn run_stage(ctx: *MagicMount.MagicMount, tmp_dir: []const u8, allocator: Allocator, title: []const u8) i32 {
+    const rc = MagicMount.magic_mount(ctx, tmp_dir, allocator) catch |err| {
+        Utils.LOGE("magic_mount failed: {s}", .{@errorName(err)});
+        return -1;
     };
 
     // Print results
@@ -352,7 +559,63 @@ pub fn main() !u8 {
         Utils.LOGE("Magic Mount Failed (rc={d})", .{rc});
     }
 
-    print_summary(&ctx);
+    print_summary(ctx, title);
+    Status.write(allocator, tmp_dir, ctx, rc) catch |err| {
+        Utils.LOGW("write {s}: {s}", .{ Status.STATUS_FILE, @errorName(err) });
+    };
+    if (Backend.get().kind == .fake) {
+        const fake: *Backend.Fake = @ptrCast(@alignCast(Backend.get().ptr));
+        fake.report();
+    }
+    return rc;
+}
+
+// Per-run results, cleared before another run in the same process.
+fn reset_run(ctx: *MagicMount.MagicMount, allocator: Allocator) void {
+    ctx.stats = std.mem.zeroes(MagicMount.MountStats);
+    if (ctx.failed_modules) |*arr| {
+        for (arr.items) |m| allocator.free(m);
+        arr.clearRetainingCapacity();
+    }
+}
+
+// Stage 2 of a two-stage run, reported on its own. The failed modules carry
+// over, the way its records are appended to the critical stage's: the
+// status snapshot covers both stages, and a module whose critical
+// partitions failed still has those mounts listed.
+fn finish_deferred(ctx: *MagicMount.MagicMount, tmp_dir: []const u8, allocator: Allocator) u8 {
+    ctx.stats = std.mem.zeroes(MagicMount.MountStats);
+    ctx.apply_stage = @intFromEnum(MagicMount.ApplyStage.deferred);
 
+    const rc = run_stage(ctx, tmp_dir, allocator, "Summary (background stage)");
     return if (rc == 0) 0 else 1;
 }
+
+// `mmd watch`: an incremental apply now, and again after every settled
+// burst of module changes. Each pass builds and frees its own tree and
+// plan, only the record file carries over, so a long-running watcher stays
+// at the size of one pass.
+fn watch_loop(ctx: *MagicMount.MagicMount, tmp_dir: []const u8, allocator: Allocator) u8 {
+    const module_dir: []const u8 = ctx.module_dir orelse MagicMount.DEFAULT_MODULE_DIR;
+    var watcher = Watch.Watcher.init(module_dir) catch |err| {
+        Utils.LOGE("watch {s}: {s}", .{ module_dir, @errorName(err) });
+        return 1;
+    };
+    defer watcher.deinit();
+
+    var pass: usize = 0;
+    while (true) : (pass += 1) {
+        if (pass > 0) reset_run(ctx, allocator);
+        _ = run_stage(ctx, tmp_dir, allocator, "Summary");
+
+        // modules added by this change need their own watch
+        watcher.sync() catch |err| {
+            Utils.LOGW("watch {s}: {s}", .{ module_dir, @errorName(err) });
+        };
+        const events = watcher.wait() catch |err| {
+            Utils.LOGE("watch {s}: {s}", .{ module_dir, @errorName(err) });
+            return 1;
+        };
+        Utils.LOGI("watch: {d} changes in {s}, re-applying", .{ events, module_dir });
+    }
+}
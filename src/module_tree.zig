@@ -6,6 +6,7 @@ const ArrayList = std.ArrayList;
 
 // --- External dependencies ---
 const MagicMount = @import("magic_mount.zig").MagicMount;
+const ApplyStage = @import("magic_mount.zig").ApplyStage;
 const Utils = @import("utils.zig");
 
 extern fn logWrite(level: i32, file: [*:0]const u8, line: c_int, fmt: [*:0]const u8, ...) void;
@@ -102,6 +103,110 @@ fn node_child_detach(parent: *Node, name: []const u8) ?*Node {
     return null;
 }
 
+// --- Chain compression ---
+//
+// Overlay modules are mostly long single-child directory chains, e.g.
+// system/etc/permissions/x.xml. After the tree is built, such a chain is
+// folded into one node whose name holds the joined components
+// ("etc/permissions"). The applier checks the whole chain against the real
+// partition in one go and only expands it (node_chain_expand) when an
+// intermediate level really needs its own tmpfs or mirroring.
+pub fn node_is_chain(n: *const Node) bool {
+    return std.mem.indexOfScalar(u8, n.name, '/') != null;
+}
+
+// The single child `n` can absorb, if any. Merging must be reversible, so the
+// child has to come from the module directory right below `n`'s.
+fn node_chain_mergeable(n: *const Node) ?*Node {
+    if (n.type != .DIRECTORY or n.replace or n.children.items.len != 1) return null;
+    const only = n.children.items[0];
+    if (only.type != .DIRECTORY or only.skip) return null;
+
+    // the system root carries no module_path; no partition root is ever
+    // offered here, node_compress starts below it
+    const mp = n.module_path orelse return null;
+    const cmp = only.module_path orelse return null;
+    if (cmp.len != mp.len + 1 + only.name.len) return null;
+    if (!std.mem.startsWith(u8, cmp, mp) or cmp[mp.len] != '/') return null;
+    return only;
+}
+
+fn node_compress(allocator: Allocator, root: *Node) !usize {
+    var merged: usize = 0;
+
+    var stack = ArrayList(*Node).init(allocator);
+    defer stack.deinit();
+    try stack.append(root);
+
+    while (stack.popOrNull()) |parent| {
+        for (parent.children.items) |c| {
+            while (node_chain_mergeable(c)) |only| {
+                const name = try std.fmt.allocPrint(allocator, "{s}/{s}", .{ c.name, only.name });
+                allocator.free(c.name);
+                c.name = name;
+
+                allocator.free(c.module_path.?);
+                c.module_path = only.module_path;
+                only.module_path = null;
+                c.replace = only.replace;
+
+                c.children.deinit();
+                c.children = only.children;
+                only.children = ArrayList(*Node).init(allocator);
+
+                only.deinit(allocator);
+                allocator.destroy(only);
+                merged += 1;
+            }
+            if (c.type == .DIRECTORY) try stack.append(c);
+        }
+    }
+    return merged;
+}
+
+/// Splits chain node `n` back into one node per component, in place: `n`
+/// keeps the first component and the rest hang below it.
+pub fn node_chain_expand(allocator: Allocator, n: *Node) !void {
+    var cur = n;
+    while (std.mem.indexOfScalar(u8, cur.name, '/')) |slash| {
+        const rest = cur.name[slash + 1 ..];
+        const head = try allocator.dupe(u8, cur.name[0..slash]);
+        errdefer allocator.free(head);
+
+        const tail = try Node.init(allocator, rest, .DIRECTORY);
+        errdefer {
+            tail.deinit(allocator);
+            allocator.destroy(tail);
+        }
+        if (cur.module_name) |mn| tail.module_name = try allocator.dupe(u8, mn);
+
+        const head_mp = if (cur.module_path) |mp| try allocator.dupe(u8, mp[0 .. mp.len - rest.len - 1]) else null;
+        errdefer if (head_mp) |p| allocator.free(p);
+        try cur.children.ensureTotalCapacity(1);
+
+        // tail takes over everything below the head
+        std.mem.swap(ArrayList(*Node), &tail.children, &cur.children);
+        tail.module_path = cur.module_path;
+        tail.replace = cur.replace;
+
+        cur.children.appendAssumeCapacity(tail);
+        cur.module_path = head_mp;
+        cur.replace = false;
+        allocator.free(cur.name);
+        cur.name = head;
+
+        cur = tail;
+    }
+}
+
+/// Expands every chain child of `n`, for directories whose real entries are
+/// matched one level at a time (tmpfs mirroring).
+pub fn node_expand_chains(allocator: Allocator, n: *Node) !void {
+    for (n.children.items) |c| {
+        if (node_is_chain(c)) try node_chain_expand(allocator, c);
+    }
+}
+
 // --- Module failure tracking ---
 pub fn module_mark_failed(ctx: *MagicMount, allocator: Allocator, module_name: []const u8) !void {
     const failed = ctx.failed_modules orelse return;
@@ -196,51 +301,102 @@ fn node_create_from_fs(
 }
 
 // --- Module disabled check ---
-fn module_is_disabled(mod_dir: [*:0]const u8) bool {
+// `mod_dir` holds the module path; it is restored before returning.
+fn module_is_disabled(mod_dir: *Utils.PathBuf) bool {
     const disable_files = [_][]const u8{ DISABLE_FILE_NAME, REMOVE_FILE_NAME, SKIP_MOUNT_FILE_NAME };
     for (disable_files) |file| {
-        var buf: [PATH_MAX]u8 = undefined;
-        const p = Utils.path_join(std.heap.page_allocator, &buf, mod_dir, file) catch continue;
-        if (Utils.path_exists(p)) return true;
+        const mark = mod_dir.push(file) catch continue;
+        defer mod_dir.pop(mark);
+        if (Utils.path_exists(mod_dir.slice())) return true;
+    }
+    return false;
+}
+
+fn name_in(list: []const []const u8, name: []const u8) bool {
+    for (list) |n| {
+        if (std.mem.eql(u8, n, name)) return true;
     }
     return false;
 }
 
-// --- Recursive directory scan ---
+// --- Directory scan ---
+//
+// Iterative depth-first walk with an explicit stack, sharing one path
+// builder across levels instead of a PATH_MAX buffer per recursion.
+const ScanFrame = struct {
+    node: *Node,
+    dir: std.fs.Dir,
+    iter: std.fs.Dir.Iterator,
+    mark: usize,
+    has_any: bool = false,
+};
+
 fn node_scan_dir(
     ctx: *MagicMount,
     allocator: Allocator,
     self: *Node,
-    dir: [*:0]const u8,
+    dir: []const u8,
     module_name: ?[]const u8,
     has_any: *bool,
+    exclude: []const []const u8,
 ) !void {
-    var d = try std.fs.cwd().openDir(dir, .{});
-    defer d.close();
+    var path = try Utils.PathBuf.init(dir);
+
+    var stack = ArrayList(ScanFrame).init(allocator);
+    defer {
+        for (stack.items) |*f| f.dir.close();
+        stack.deinit();
+    }
 
-    var iter = d.iterate();
-    while (try iter.next()) |entry| {
+    var d = try std.fs.cwd().openDir(dir, .{ .iterate = true });
+    try stack.append(.{ .node = self, .dir = d, .iter = d.iterate(), .mark = path.len });
+
+    while (stack.items.len > 0) {
+        const top = &stack.items[stack.items.len - 1];
+
+        const entry = (try top.iter.next()) orelse {
+            var done = stack.pop();
+            done.dir.close();
+            path.pop(done.mark);
+            if (stack.items.len == 0) {
+                if (done.has_any) has_any.* = true;
+            } else if (done.has_any or done.node.replace) {
+                stack.items[stack.items.len - 1].has_any = true;
+            }
+            continue;
+        };
         if (std.mem.eql(u8, ".", entry.name) or std.mem.eql(u8, "..", entry.name)) continue;
+        // `exclude` only filters the top level
+        if (stack.items.len == 1 and name_in(exclude, entry.name)) continue;
 
-        var path_buf: [PATH_MAX]u8 = undefined;
-        const path = Utils.path_join(allocator, &path_buf, dir, entry.name) catch continue;
+        const mark = path.push(entry.name) catch continue;
 
-        var child = node_child_find(self, entry.name);
+        var child = node_child_find(top.node, entry.name);
         if (child == null) {
-            const n = (try node_create_from_fs(ctx, allocator, entry.name, path, module_name)) orelse continue;
-            try self.children.append(n);
+            const n = (try node_create_from_fs(ctx, allocator, entry.name, path.slice(), module_name)) orelse {
+                path.pop(mark);
+                continue;
+            };
+            try top.node.children.append(n);
             child = n;
         }
 
-        if (child) |c| {
-            if (c.type == .DIRECTORY) {
-                var sub: bool = false;
-                try node_scan_dir(ctx, allocator, c, path, module_name, &sub);
-                if (sub or c.replace) has_any.* = true;
-            } else {
-                has_any.* = true;
-            }
+        const c = child.?;
+        if (c.type != .DIRECTORY) {
+            top.has_any = true;
+            path.pop(mark);
+            continue;
         }
+
+        d = top.dir.openDir(entry.name, .{ .iterate = true }) catch |err| {
+            path.pop(mark);
+            return err;
+        };
+        // `top` is invalidated by the append
+        stack.append(.{ .node = c, .dir = d, .iter = d.iterate(), .mark = mark }) catch |err| {
+            d.close();
+            return err;
+        };
     }
 }
 
@@ -271,32 +427,27 @@ fn is_compatible_symlink(
     return false;
 }
 
+// The first module, in module order, with a real <part> dir.
 fn find_real_partition_dir(
-    ctx: *MagicMount,
     allocator: Allocator,
+    mdir: []const u8,
+    modules: []const ModuleEntry,
     part_name: []const u8,
     out_path: *[PATH_MAX]u8,
     out_module: *[]u8,
 ) !bool {
-    var mod_dir = try std.fs.cwd().openDir(ctx.module_dir.?, .{});
-    defer mod_dir.close();
-
-    var iter = mod_dir.iterate();
-    while (try iter.next()) |mod_entry| {
-        if (std.mem.eql(u8, ".", mod_entry.name) or std.mem.eql(u8, "..", mod_entry.name)) continue;
-
-        var mod_path_buf: [PATH_MAX]u8 = undefined;
-        const mod_path = Utils.path_join(allocator, &mod_path_buf, ctx.module_dir.?, mod_entry.name) catch continue;
-        const st = os.stat(mod_path) catch continue;
-        if (!os.S.ISDIR(st.mode)) continue;
-        if (module_is_disabled(mod_path)) continue;
-
-        var part_path_buf: [PATH_MAX]u8 = undefined;
-        const part_path = Utils.path_join(allocator, &part_path_buf, mod_path, part_name) catch continue;
-        if (Utils.path_is_dir(part_path)) {
+    var path = try Utils.PathBuf.init(mdir);
+    const base = path.len;
+
+    for (modules) |m| {
+        path.pop(base);
+        _ = path.push(m.name) catch continue;
+        _ = path.push(part_name) catch continue;
+        if (Utils.path_is_dir(path.slice())) {
+            const part_path = path.slice();
             @memcpy(out_path[0..part_path.len], part_path);
             out_path[part_path.len] = 0;
-            out_module.* = try allocator.dupe(u8, mod_entry.name);
+            out_module.* = try allocator.dupe(u8, m.name);
             return true;
         }
     }
@@ -306,6 +457,8 @@ fn find_real_partition_dir(
 fn symlink_resolve_partition(
     ctx: *MagicMount,
     allocator: Allocator,
+    mdir: []const u8,
+    modules: []const ModuleEntry,
     system: *Node,
     part_name: []const u8,
 ) !void {
@@ -319,12 +472,12 @@ fn symlink_resolve_partition(
 
     var real_part_path: [PATH_MAX]u8 = undefined;
     var module_name: []u8 = undefined;
-    const found = find_real_partition_dir(ctx, allocator, part_name, &real_part_path, &module_name) catch return;
+    const found = find_real_partition_dir(allocator, mdir, modules, part_name, &real_part_path, &module_name) catch return;
     if (!found) return;
 
     const new_part = try Node.init(allocator, part_name, .DIRECTORY);
     var part_has_any: bool = false;
-    try node_scan_dir(ctx, allocator, new_part, real_part_path[0..std.mem.indexOfScalar(u8, &real_part_path, 0).?], module_name, &part_has_any);
+    try node_scan_dir(ctx, allocator, new_part, real_part_path[0..std.mem.indexOfScalar(u8, &real_part_path, 0).?], module_name, &part_has_any, &.{});
 
     if (!part_has_any) {
         new_part.deinit(allocator);
@@ -338,161 +491,440 @@ fn symlink_resolve_partition(
     LOG(LOG_INFO, "replaced symlink with directory node: {s} (from module '{s}')", .{ part_name, module_name });
 }
 
-fn symlink_resolve_all_partition_links(ctx: *MagicMount, allocator: Allocator, system: *Node) !void {
-    const builtin_parts = [_][]const u8{ "vendor", "system_ext", "product", "odm" };
-    for (builtin_parts) |part| {
-        try symlink_resolve_partition(ctx, allocator, system, part);
+fn symlink_resolve_all_partition_links(ctx: *MagicMount, allocator: Allocator, mdir: []const u8, modules: []const ModuleEntry, system: *Node) !void {
+    // promoted partitions were never scanned into `system`, so this only
+    // touches the ones that stay below it
+    for (builtin_parts) |bp| {
+        try symlink_resolve_partition(ctx, allocator, mdir, modules, system, bp.name);
     }
 
     const extra = ctx.extra_parts orelse return;
     for (extra.items) |part| {
-        try symlink_resolve_partition(ctx, allocator, system, part);
+        try symlink_resolve_partition(ctx, allocator, mdir, modules, system, part);
     }
 }
 
 // --- Partition scan from modules ---
+// <module>/<part> of every module, in module order like the promoted scan.
 fn partition_scan_from_modules(
     ctx: *MagicMount,
     allocator: Allocator,
+    mdir: []const u8,
+    modules: []const ModuleEntry,
     part_name: []const u8,
     parent_node: *Node,
 ) !bool {
-    var mod_dir = try std.fs.cwd().openDir(ctx.module_dir.?, .{});
-    defer mod_dir.close();
+    var path = try Utils.PathBuf.init(mdir);
+    const base = path.len;
 
     var has_any = false;
-    var iter = mod_dir.iterate();
-    while (try iter.next()) |mod_entry| {
-        if (std.mem.eql(u8, ".", mod_entry.name) or std.mem.eql(u8, "..", mod_entry.name)) continue;
-
-        var mod_path_buf: [PATH_MAX]u8 = undefined;
-        const mod_path = Utils.path_join(allocator, &mod_path_buf, ctx.module_dir.?, mod_entry.name) catch continue;
-        const st = os.stat(mod_path) catch continue;
-        if (!os.S.ISDIR(st.mode)) continue;
-        if (module_is_disabled(mod_path)) continue;
-
-        var part_path_buf: [PATH_MAX]u8 = undefined;
-        const part_path = Utils.path_join(allocator, &part_path_buf, mod_path, part_name) catch continue;
-        if (!Utils.path_is_dir(part_path)) continue;
+    for (modules) |m| {
+        path.pop(base);
+        _ = path.push(m.name) catch continue;
+        _ = path.push(part_name) catch continue;
+        if (!Utils.path_is_dir(path.slice())) continue;
 
         var sub: bool = false;
-        try node_scan_dir(ctx, allocator, parent_node, part_path, mod_entry.name, &sub);
+        try node_scan_dir(ctx, allocator, parent_node, path.slice(), m.name, &sub, &.{});
         if (sub) has_any = true;
     }
     return has_any;
 }
 
 // --- Partition promotion ---
-fn partition_promote_to_root(
-    root: *Node,
-    system: *Node,
-    part_name: []const u8,
-    need_symlink: bool,
-) !void {
+//
+// vendor, system_ext, product and odm live in modules under system/, but are
+// applied at / when the device has them as separate partitions. That is
+// decided from the real filesystem alone, before any module is scanned.
+const BuiltinPart = struct { name: []const u8, need_symlink: bool };
+const builtin_parts = [_]BuiltinPart{
+    .{ .name = "vendor", .need_symlink = true },
+    .{ .name = "system_ext", .need_symlink = true },
+    .{ .name = "product", .need_symlink = true },
+    .{ .name = "odm", .need_symlink = false },
+};
+
+fn partition_is_promoted(part_name: []const u8, need_symlink: bool) bool {
     var rp_buf: [PATH_MAX]u8 = undefined;
-    const rp = Utils.path_join(std.heap.page_allocator, &rp_buf, "/", part_name) catch return;
-    if (!Utils.path_is_dir(rp)) return;
+    const rp = Utils.path_join(std.heap.page_allocator, &rp_buf, "/", part_name) catch return false;
+    if (!Utils.path_is_dir(rp)) return false;
 
     if (need_symlink) {
         var sp_buf: [PATH_MAX]u8 = undefined;
-        const sp = Utils.path_join(std.heap.page_allocator, &sp_buf, "/system", part_name) catch return;
-        if (!Utils.path_is_symlink(sp)) return;
+        const sp = Utils.path_join(std.heap.page_allocator, &sp_buf, "/system", part_name) catch return false;
+        if (!Utils.path_is_symlink(sp)) return false;
     }
-
-    const child = node_child_detach(system, part_name) orelse return;
-    try root.children.append(child);
-    LOG(LOG_DEBUG, "promoting '{s}' from /system to /", .{part_name});
+    return true;
 }
 
-// --- Main tree builder ---
-pub fn build_mount_tree(ctx: *MagicMount, allocator: Allocator) !?*Node {
-    const mdir = ctx.module_dir orelse DEFAULT_MODULE_DIR;
-
-    LOG(LOG_INFO, "build_mount_tree: module_dir={s}", .{mdir});
+// --- Module enumeration ---
+const ModuleEntry = struct {
+    name: []u8,
+    has_system: bool,
+};
 
-    var root = try Node.init(allocator, "", .DIRECTORY);
-    var system = try Node.init(allocator, "system", .DIRECTORY);
-    defer {
-        if (build_mount_tree) {
-            // Only deinit if we return null
-        }
-    }
+fn modules_enabled(ctx: *MagicMount, allocator: Allocator, mdir: []const u8) !ArrayList(ModuleEntry) {
+    var list = ArrayList(ModuleEntry).init(allocator);
+    errdefer modules_free(allocator, &list);
 
-    var mod_dir = try std.fs.cwd().openDir(mdir.*, .{});
+    var mod_dir = try std.fs.cwd().openDir(mdir, .{ .iterate = true });
     defer mod_dir.close();
 
-    var has_any = false;
+    var path = try Utils.PathBuf.init(mdir);
+    const base = path.len;
+
     var iter = mod_dir.iterate();
     while (try iter.next()) |mod_entry| {
         if (std.mem.eql(u8, ".", mod_entry.name) or std.mem.eql(u8, "..", mod_entry.name)) continue;
 
-        var mod_path_buf: [PATH_MAX]u8 = undefined;
-        const mod_path = Utils.path_join(allocator, &mod_path_buf, mdir.*, mod_entry.name) catch |err| {
+        path.pop(base);
+        _ = path.push(mod_entry.name) catch |err| {
             LOG(LOG_ERROR, "build_mount_tree: path_join failed: {s}", .{@errorName(err)});
             return err;
         };
 
-        const st = os.stat(mod_path) catch continue;
+        const st = os.stat(path.slice()) catch continue;
         if (!os.S.ISDIR(st.mode)) continue;
-        if (module_is_disabled(mod_path)) continue;
+        if (module_is_disabled(&path)) continue;
 
-        var mod_sys_buf: [PATH_MAX]u8 = undefined;
-        const mod_sys = Utils.path_join(allocator, &mod_sys_buf, mod_path, "system") catch |err| {
+        _ = path.push("system") catch |err| {
             LOG(LOG_ERROR, "build_mount_tree: path_join system failed: {s}", .{@errorName(err)});
             return err;
         };
+        const has_system = Utils.path_is_dir(path.slice());
+        if (has_system) {
+            LOG(LOG_INFO, "build_mount_tree: collecting module {s}", .{mod_entry.name});
+            ctx.stats.modules_total += 1;
+        }
+
+        try list.append(.{ .name = try allocator.dupe(u8, mod_entry.name), .has_system = has_system });
+    }
+
+    // scan order must not depend on readdir order
+    std.sort.pdq(ModuleEntry, list.items, {}, module_entry_less);
+    return list;
+}
+
+fn module_entry_less(_: void, a: ModuleEntry, b: ModuleEntry) bool {
+    return std.mem.lessThan(u8, a.name, b.name);
+}
+
+fn modules_free(allocator: Allocator, list: *ArrayList(ModuleEntry)) void {
+    for (list.items) |m| allocator.free(m.name);
+    list.deinit();
+}
 
-        if (!Utils.path_is_dir(mod_sys)) continue;
+// --- Module set fingerprint ---
+//
+// Identifies what a run would mount without scanning any module tree: every
+// module directory by name, inode and mtime (an update is installed as a new
+// directory, and creating disable/remove/skip_mount touches the mtime), plus
+// the options that change the result. A file edited inside a module in place
+// is not seen.
+const FingerprintEntry = struct { name: []u8, ino: u64, mtime_sec: i64, mtime_nsec: u32 };
+
+fn fingerprint_entry_less(_: void, a: FingerprintEntry, b: FingerprintEntry) bool {
+    return std.mem.lessThan(u8, a.name, b.name);
+}
+
+pub fn modules_fingerprint(ctx: *const MagicMount, allocator: Allocator) !u64 {
+    var list = ArrayList(FingerprintEntry).init(allocator);
+    defer {
+        for (list.items) |e| allocator.free(e.name);
+        list.deinit();
+    }
+
+    var mod_dir = try std.fs.cwd().openDir(ctx.module_dir.?, .{ .iterate = true });
+    defer mod_dir.close();
 
-        LOG(LOG_INFO, "build_mount_tree: collecting module {s}", .{mod_entry.name});
-        ctx.stats.modules_total += 1;
+    var iter = mod_dir.iterate();
+    while (try iter.next()) |e| {
+        if (e.kind != .directory) continue;
+        var stx: linux.Statx = undefined;
+        var name_buf: [256]u8 = undefined;
+        if (e.name.len >= name_buf.len) continue;
+        @memcpy(name_buf[0..e.name.len], e.name);
+        name_buf[e.name.len] = 0;
+        const rc = linux.statx(mod_dir.fd, name_buf[0..e.name.len :0], linux.AT.SYMLINK_NOFOLLOW, linux.STATX_INO | linux.STATX_MTIME, &stx);
+        if (linux.getErrno(rc) != .SUCCESS) continue;
+
+        const name = try allocator.dupe(u8, e.name);
+        errdefer allocator.free(name);
+        try list.append(.{ .name = name, .ino = stx.ino, .mtime_sec = stx.mtime.tv_sec, .mtime_nsec = stx.mtime.tv_nsec });
+    }
+    std.sort.pdq(FingerprintEntry, list.items, {}, fingerprint_entry_less);
+
+    var h = std.hash.Wyhash.init(0);
+    h.update(ctx.module_dir.?);
+    h.update(std.mem.sliceTo(ctx.mount_source, 0));
+    h.update(std.mem.asBytes(&ctx.inline_copy_kb));
+    h.update(std.mem.asBytes(&ctx.max_mounts));
+    if (ctx.extra_parts) |extra| {
+        for (extra.items) |p| {
+            h.update(p);
+            h.update("\x00");
+        }
+    }
+    for (list.items) |e| {
+        h.update(e.name);
+        h.update("\x00");
+        h.update(std.mem.asBytes(&e.ino));
+        h.update(std.mem.asBytes(&e.mtime_sec));
+        h.update(std.mem.asBytes(&e.mtime_nsec));
+    }
+    return h.final();
+}
+
+// Scan <module>/system/<part> of every module into `node`. A module whose
+// system/<part> is the usual compatibility symlink to its own /<part> is
+// scanned from there instead. Like the scanned node it replaces, the root
+// takes module path, name and replace flag from the first module that has
+// the partition, so new top-level entries can get a tmpfs and .replace works.
+fn partition_scan_promoted(
+    ctx: *MagicMount,
+    allocator: Allocator,
+    mdir: []const u8,
+    modules: []const ModuleEntry,
+    part_name: []const u8,
+    node: *Node,
+) !bool {
+    var path = try Utils.PathBuf.init(mdir);
+    const base = path.len;
+
+    var has_any = false;
+    for (modules) |m| {
+        if (!m.has_system) continue;
+
+        path.pop(base);
+        _ = path.push(m.name) catch continue;
+        const mod_mark = path.push("system") catch continue;
+        _ = path.push(part_name) catch continue;
+
+        if (Utils.path_is_symlink(path.slice())) {
+            var target_buf: [PATH_MAX]u8 = undefined;
+            const target = os.readlink(path.slice(), &target_buf) catch continue;
+            if (!is_compatible_symlink(target, part_name, ctx, m.name)) {
+                LOG(LOG_WARN, "ignoring {s}: symlink to {s}", .{ path.slice(), target });
+                continue;
+            }
+            path.pop(mod_mark);
+            _ = path.push(part_name) catch continue;
+            LOG(LOG_INFO, "partition {s}: using /{s} of module '{s}'", .{ part_name, part_name, m.name });
+        }
+        if (!Utils.path_is_dir(path.slice())) continue;
+
+        if (node.module_path == null) {
+            node.module_path = try allocator.dupe(u8, path.slice());
+            node.module_name = try allocator.dupe(u8, m.name);
+            node.replace = dir_is_replace(path.slice());
+        }
 
         var sub: bool = false;
-        try node_scan_dir(ctx, allocator, system, mod_sys, mod_entry.name, &sub);
+        try node_scan_dir(ctx, allocator, node, path.slice(), m.name, &sub, &.{});
         if (sub) has_any = true;
     }
+    return has_any or node.replace;
+}
+
+// --- Streaming tree builder ---
+//
+// Partitions are built one at a time and handed to `sink` as soon as every
+// module has been scanned for them, so the caller can start applying
+// /vendor while /product and /system are still being scanned. By default
+// promoted partitions and extra partitions come first and the big /system
+// tree last; `priority` in the config reorders them, and a two-stage run
+// builds only the critical or only the remaining partitions per stage.
+pub const PartitionSink = struct {
+    ptr: *anyopaque,
+    // takes ownership of `part`
+    emit: *const fn (ptr: *anyopaque, part: *Node) void,
+};
 
+fn partition_emit(allocator: Allocator, sink: PartitionSink, part: *Node, has_any: bool, merged: *usize) !bool {
     if (!has_any) {
-        root.deinit(allocator);
-        allocator.destroy(root);
-        system.deinit(allocator);
-        allocator.destroy(system);
-        return null;
+        part.deinit(allocator);
+        allocator.destroy(part);
+        return false;
     }
+    merged.* += try node_compress(allocator, part);
+    LOG(LOG_DEBUG, "build_mount_tree: partition '{s}' ready", .{part.name});
+    sink.emit(sink.ptr, part);
+    return true;
+}
 
-    ctx.stats.nodes_total += 2;
+// One partition the builder can produce.
+const PartKind = enum { promoted, extra, system };
+const PartUnit = struct {
+    name: []const u8,
+    kind: PartKind,
+    rank: usize,
+};
 
-    try symlink_resolve_all_partition_links(ctx, allocator, system);
+fn part_unit_less(_: void, a: PartUnit, b: PartUnit) bool {
+    return a.rank < b.rank;
+}
 
-    const BuiltinPart = struct { name: []const u8, need_symlink: bool };
-    const builtin_parts = [_]BuiltinPart{
-        .{ .name = "vendor", .need_symlink = true },
-        .{ .name = "system_ext", .need_symlink = true },
-        .{ .name = "product", .need_symlink = true },
-        .{ .name = "odm", .need_symlink = false },
-    };
+fn name_list_index(list: ?ArrayList([]u8), name: []const u8) ?usize {
+    const l = list orelse return null;
+    for (l.items, 0..) |n, i| {
+        if (std.mem.eql(u8, n, name)) return i;
+    }
+    return null;
+}
+
+pub fn partition_is_critical(ctx: *const MagicMount, name: []const u8) bool {
+    return name_list_index(ctx.critical_parts, name) != null;
+}
+
+// The partitions to build in this stage, in apply order: the configured
+// priority order first, then the default order (promoted, extra, system).
+fn partition_units(ctx: *MagicMount, allocator: Allocator, promoted: *ArrayList([]const u8)) !ArrayList(PartUnit) {
+    var units = ArrayList(PartUnit).init(allocator);
+    errdefer units.deinit();
 
     for (builtin_parts) |bp| {
-        try partition_promote_to_root(root, system, bp.name, bp.need_symlink);
+        if (!partition_is_promoted(bp.name, bp.need_symlink)) continue;
+        // /system never scans these, whichever stage builds them
+        try promoted.append(bp.name);
+        try units.append(.{ .name = bp.name, .kind = .promoted, .rank = 0 });
+    }
+    if (ctx.extra_parts) |extra| {
+        for (extra.items) |name| {
+            var rp_buf: [PATH_MAX]u8 = undefined;
+            const rp = Utils.path_join(allocator, &rp_buf, "/", name) catch continue;
+            if (!Utils.path_is_dir(rp)) continue;
+            try units.append(.{ .name = name, .kind = .extra, .rank = 0 });
+        }
+    }
+    try units.append(.{ .name = "system", .kind = .system, .rank = 0 });
+
+    const stage: ApplyStage = @enumFromInt(ctx.apply_stage);
+    const n_order = if (ctx.partition_order) |o| o.items.len else 0;
+
+    var kept: usize = 0;
+    for (units.items, 0..) |u, i| {
+        const critical = partition_is_critical(ctx, u.name);
+        switch (stage) {
+            .all => {},
+            .critical => if (!critical) continue,
+            .deferred => if (critical) continue,
+        }
+        var unit = u;
+        unit.rank = if (name_list_index(ctx.partition_order, u.name)) |r| r else n_order + i;
+        units.items[kept] = unit;
+        kept += 1;
+    }
+    units.shrinkRetainingCapacity(kept);
+    std.sort.insertion(PartUnit, units.items, {}, part_unit_less);
+    return units;
+}
+
+fn partition_build(
+    ctx: *MagicMount,
+    allocator: Allocator,
+    mdir: []const u8,
+    modules: []const ModuleEntry,
+    promoted: []const []const u8,
+    unit: PartUnit,
+    part: *Node,
+) !bool {
+    switch (unit.kind) {
+        .promoted => return partition_scan_promoted(ctx, allocator, mdir, modules, unit.name, part),
+        .extra => return partition_scan_from_modules(ctx, allocator, mdir, modules, unit.name, part),
+        .system => {
+            var has_any = false;
+            var path = try Utils.PathBuf.init(mdir);
+            const base = path.len;
+            for (modules) |m| {
+                if (!m.has_system) continue;
+                path.pop(base);
+                _ = try path.push(m.name);
+                _ = try path.push("system");
+
+                var sub: bool = false;
+                try node_scan_dir(ctx, allocator, part, path.slice(), m.name, &sub, promoted);
+                if (sub) has_any = true;
+            }
+
+            try symlink_resolve_all_partition_links(ctx, allocator, mdir, modules, part);
+            return has_any;
+        },
     }
+}
 
-    const extra = ctx.extra_parts orelse {};
-    for (extra.items) |name| {
-        var rp_buf: [PATH_MAX]u8 = undefined;
-        const rp = Utils.path_join(allocator, &rp_buf, "/", name) catch continue;
-        if (!Utils.path_is_dir(rp)) continue;
+/// Builds the mount tree partition by partition, in priority order and
+/// limited to ctx.apply_stage; returns how many partitions were handed to
+/// `sink`.
+pub fn build_mount_tree_streaming(ctx: *MagicMount, allocator: Allocator, sink: PartitionSink) !usize {
+    const mdir = ctx.module_dir orelse DEFAULT_MODULE_DIR;
 
-        const child = try Node.init(allocator, name, .DIRECTORY);
-        const has_content = try partition_scan_from_modules(ctx, allocator, name, child);
-        if (has_content) {
-            try root.children.append(child);
-        } else {
-            child.deinit(allocator);
-            allocator.destroy(child);
+    LOG(LOG_INFO, "build_mount_tree: module_dir={s}", .{mdir});
+
+    var modules = try modules_enabled(ctx, allocator, mdir);
+    defer modules_free(allocator, &modules);
+
+    var promoted = ArrayList([]const u8).init(allocator);
+    defer promoted.deinit();
+    var units = try partition_units(ctx, allocator, &promoted);
+    defer units.deinit();
+
+    var emitted: usize = 0;
+    var merged: usize = 0;
+
+    for (units.items) |unit| {
+        const part = try Node.init(allocator, unit.name, .DIRECTORY);
+        const has_any = partition_build(ctx, allocator, mdir, modules.items, promoted.items, unit, part) catch |err| {
+            part.deinit(allocator);
+            allocator.destroy(part);
+            return err;
+        };
+        if (try partition_emit(allocator, sink, part, has_any, &merged)) {
+            if (unit.kind == .promoted) LOG(LOG_DEBUG, "promoting '{s}' from /system to /", .{unit.name});
+            if (unit.kind != .extra) ctx.stats.nodes_total += 1;
+            emitted += 1;
         }
     }
 
-    try root.children.append(system);
+    if (emitted > 0) {
+        // the root itself
+        ctx.stats.nodes_total += 1;
+        LOG(LOG_INFO, "build_mount_tree: {d} partitions built ({d} chain levels compressed)", .{ emitted, merged });
+    }
+    return emitted;
+}
+
+const TreeCollector = struct {
+    root: *Node,
+    err: ?anyerror = null,
+
+    fn emit(ptr: *anyopaque, part: *Node) void {
+        const self: *TreeCollector = @ptrCast(@alignCast(ptr));
+        self.root.children.append(part) catch |err| {
+            self.err = err;
+            part.deinit(self.root.children.allocator);
+            self.root.children.allocator.destroy(part);
+        };
+    }
+};
+
+// --- Main tree builder ---
+/// Builds the whole tree up front, for callers that need all of it at once.
+pub fn build_mount_tree(ctx: *MagicMount, allocator: Allocator) !?*Node {
+    const root = try Node.init(allocator, "", .DIRECTORY);
+    errdefer {
+        root.deinit(allocator);
+        allocator.destroy(root);
+    }
+
+    var collector: TreeCollector = .{ .root = root };
+    const n = try build_mount_tree_streaming(ctx, allocator, .{ .ptr = &collector, .emit = TreeCollector.emit });
+    if (collector.err) |err| return err;
+
+    if (n == 0) {
+        root.deinit(allocator);
+        allocator.destroy(root);
+        return null;
+    }
 
     LOG(LOG_INFO, "build_mount_tree: root tree successfully built", .{});
     return root;
@@ -508,4 +940,12 @@ pub fn module_tree_cleanup(ctx: *MagicMount, allocator: Allocator) void {
         for (arr.items) |s| allocator.free(s);
         arr.deinit();
     }
+    if (ctx.partition_order) |arr| {
+        for (arr.items) |s| allocator.free(s);
+        arr.deinit();
+    }
+    if (ctx.critical_parts) |arr| {
+        for (arr.items) |s| allocator.free(s);
+        arr.deinit();
+    }
 }
@@ -0,0 +1,206 @@
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const ArrayList = std.ArrayList;
+
+const READ_CHUNK = 64 * 1024;
+
+// --- /proc/self/mountinfo ---
+//
+// The whole file is read into one buffer and every field of an entry is a
+// slice into it; escaped paths (\040 and friends) are decoded in place, which
+// only ever shrinks them. A mount namespace on a device with many modules has
+// thousands of lines, so there is no allocation per line, only the entry
+// array and the path index.
+pub const Entry = struct {
+    id: u32,
+    parent: u32,
+    major: u32,
+    minor: u32,
+    root: []const u8,
+    mount_point: []const u8,
+    // per-mount options (ro/rw, nosuid, ...)
+    options: []const u8,
+    fstype: []const u8,
+    source: []const u8,
+    super_options: []const u8,
+
+    pub fn has_option(self: *const Entry, opt: []const u8) bool {
+        var it = std.mem.splitScalar(u8, self.options, ',');
+        while (it.next()) |o| {
+            if (std.mem.eql(u8, o, opt)) return true;
+        }
+        return false;
+    }
+
+    pub fn read_only(self: *const Entry) bool {
+        return self.has_option("ro");
+    }
+};
+
+pub const MountInfo = struct {
+    allocator: Allocator,
+    buf: []u8,
+    entries: ArrayList(Entry),
+    // entry indices sorted by mount point, then by position in the file
+    index: ArrayList(u32),
+
+    pub fn load(allocator: Allocator) !MountInfo {
+        return load_path(allocator, "/proc/self/mountinfo");
+    }
+
+    pub fn load_path(allocator: Allocator, path: []const u8) !MountInfo {
+        const buf = try read_all(allocator, path);
+        errdefer allocator.free(buf);
+
+        var self: MountInfo = .{
+            .allocator = allocator,
+            .buf = buf,
+            .entries = ArrayList(Entry).init(allocator),
+            .index = ArrayList(u32).init(allocator),
+        };
+        errdefer self.entries.deinit();
+        errdefer self.index.deinit();
+
+        // a line is roughly 100-150 bytes
+        try self.entries.ensureTotalCapacity(buf.len / 96 + 1);
+        var lines = std.mem.splitScalar(u8, buf, '\n');
+        while (lines.next()) |line| {
+            if (line.len == 0) continue;
+            // lines come from the kernel; one we cannot parse is skipped
+            // rather than failing the whole read
+            const e = parse_line(@constCast(line)) orelse continue;
+            try self.entries.append(e);
+        }
+
+        try self.index.ensureTotalCapacity(self.entries.items.len);
+        for (self.entries.items, 0..) |_, i| self.index.appendAssumeCapacity(@intCast(i));
+        std.sort.pdq(u32, self.index.items, @as(*const MountInfo, &self), index_less);
+        return self;
+    }
+
+    pub fn deinit(self: *MountInfo) void {
+        self.index.deinit();
+        self.entries.deinit();
+        self.allocator.free(self.buf);
+    }
+
+    fn index_less(self: *const MountInfo, a: u32, b: u32) bool {
+        const pa = self.entries.items[a].mount_point;
+        const pb = self.entries.items[b].mount_point;
+        return switch (std.mem.order(u8, pa, pb)) {
+            .lt => true,
+            .gt => false,
+            .eq => a < b,
+        };
+    }
+
+    /// All mounts stacked on `path`, in file order.
+    pub fn at(self: *const MountInfo, path: []const u8) []const u32 {
+        const items = self.index.items;
+        var lo: usize = 0;
+        var hi: usize = items.len;
+        while (lo < hi) {
+            const mid = lo + (hi - lo) / 2;
+            if (std.mem.order(u8, self.entries.items[items[mid]].mount_point, path) == .lt) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        var end = lo;
+        while (end < items.len and std.mem.eql(u8, self.entries.items[items[end]].mount_point, path)) end += 1;
+        return items[lo..end];
+    }
+
+    /// The visible mount on `path`: the one no other mount on the same path
+    /// is stacked on top of. File order alone is not enough, moved mounts
+    /// keep their place in the list.
+    pub fn find(self: *const MountInfo, path: []const u8) ?*const Entry {
+        const stack = self.at(path);
+        outer: for (stack) |i| {
+            const e = &self.entries.items[i];
+            for (stack) |j| {
+                if (j != i and self.entries.items[j].parent == e.id) continue :outer;
+            }
+            return e;
+        }
+        return null;
+    }
+};
+
+fn read_all(allocator: Allocator, path: []const u8) ![]u8 {
+    const file = try std.fs.cwd().openFile(path, .{});
+    defer file.close();
+
+    // procfs reports size 0, so read until EOF into a growing buffer
+    var buf = ArrayList(u8).init(allocator);
+    errdefer buf.deinit();
+    while (true) {
+        try buf.ensureUnusedCapacity(READ_CHUNK);
+        const n = try file.read(buf.unusedCapacitySlice());
+        if (n == 0) break;
+        buf.items.len += n;
+    }
+    return buf.toOwnedSlice();
+}
+
+// 36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw,errors=continue
+fn parse_line(line: []u8) ?Entry {
+    var it = std.mem.splitScalar(u8, line, ' ');
+
+    const id = std.fmt.parseInt(u32, it.next() orelse return null, 10) catch return null;
+    const parent = std.fmt.parseInt(u32, it.next() orelse return null, 10) catch return null;
+    const dev = it.next() orelse return null;
+    const colon = std.mem.indexOfScalar(u8, dev, ':') orelse return null;
+    const major = std.fmt.parseInt(u32, dev[0..colon], 10) catch return null;
+    const minor = std.fmt.parseInt(u32, dev[colon + 1 ..], 10) catch return null;
+    const root = it.next() orelse return null;
+    const mount_point = it.next() orelse return null;
+    const options = it.next() orelse return null;
+
+    // optional fields up to the "-" separator
+    while (true) {
+        const f = it.next() orelse return null;
+        if (std.mem.eql(u8, f, "-")) break;
+    }
+
+    const fstype = it.next() orelse return null;
+    const source = it.next() orelse return null;
+    const super_options = it.rest();
+
+    return .{
+        .id = id,
+        .parent = parent,
+        .major = major,
+        .minor = minor,
+        .root = unescape(@constCast(root)),
+        .mount_point = unescape(@constCast(mount_point)),
+        .options = options,
+        .fstype = fstype,
+        .source = unescape(@constCast(source)),
+        .super_options = super_options,
+    };
+}
+
+// Decode the kernel's \ooo escapes (space, tab, newline, backslash) in place.
+pub fn unescape(s: []u8) []u8 {
+    if (std.mem.indexOfScalar(u8, s, '\\') == null) return s;
+
+    var r: usize = 0;
+    var w: usize = 0;
+    while (r < s.len) {
+        if (s[r] == '\\' and r + 3 < s.len and s[r + 1] >= '0' and s[r + 1] <= '3' and is_octal(s[r + 2]) and is_octal(s[r + 3])) {
+            s[w] = (s[r + 1] - '0') * 64 + (s[r + 2] - '0') * 8 + (s[r + 3] - '0');
+            r += 4;
+        } else {
+            s[w] = s[r];
+            r += 1;
+        }
+        w += 1;
+    }
+    return s[0..w];
+}
+
+fn is_octal(c: u8) bool {
+    return c >= '0' and c <= '7';
+}
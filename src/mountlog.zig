@@ -0,0 +1,315 @@
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const ArrayList = std.ArrayList;
+
+const Utils = @import("utils.zig");
+const unescape = @import("mountinfo.zig").unescape;
+const PathIndex = @import("pathindex.zig");
+
+const SAVE_HEADER = "# mmd mounts v2 ";
+
+// --- Mount records ---
+//
+// Every mount a run leaves behind is one more mountinfo line that each app
+// namespace clone has to copy. Appliers record each one as they make it;
+// the records are merged after the apply and sorted by path, so the report
+// (and anything persisted from it) does not depend on scheduling. The sort
+// is PathIndex.path_order, which keeps each subtree in one run; load()
+// sorts too, since a two-stage file is two sorted runs.
+// A mirror is a real file bound back into a tmpfs dir over its own path.
+pub const Kind = enum { bind, tmpfs, mirror };
+
+pub const Record = struct {
+    path: []u8,
+    source: []u8,
+    kind: Kind,
+    module: ?[]u8,
+    partition: []u8,
+};
+
+// A top-level mount point (a bind outside any tmpfs, or a tmpfs dir) and a
+// digest of the module subtree that produced it; what an incremental apply
+// diffs against.
+pub const Unit = struct {
+    path: []u8,
+    digest: u64,
+};
+
+pub const Span = struct { lo: usize, hi: usize };
+
+// How far a log had grown, for rollback().
+pub const Mark = struct { records: usize = 0, units: usize = 0 };
+
+pub const MountLog = struct {
+    allocator: Allocator,
+    records: ArrayList(Record),
+    units: ArrayList(Unit),
+    // module set fingerprint and the run id the tmpfs dirs are marked with
+    fingerprint: u64 = 0,
+    run_id: u64 = 0,
+
+    pub fn init(allocator: Allocator) MountLog {
+        return .{
+            .allocator = allocator,
+            .records = ArrayList(Record).init(allocator),
+            .units = ArrayList(Unit).init(allocator),
+        };
+    }
+
+    pub fn deinit(self: *MountLog) void {
+        for (self.records.items) |r| self.free_record(r);
+        self.records.deinit();
+        for (self.units.items) |u| self.allocator.free(u.path);
+        self.units.deinit();
+    }
+
+    fn free_record(self: *MountLog, r: Record) void {
+        self.allocator.free(r.path);
+        self.allocator.free(r.source);
+        if (r.module) |m| self.allocator.free(m);
+        self.allocator.free(r.partition);
+    }
+
+    pub fn add(self: *MountLog, path: []const u8, source: []const u8, kind: Kind, module: ?[]const u8, partition: []const u8) !void {
+        var r: Record = .{
+            .path = try self.allocator.dupe(u8, path),
+            .source = undefined,
+            .kind = kind,
+            .module = null,
+            .partition = undefined,
+        };
+        errdefer self.allocator.free(r.path);
+        r.source = try self.allocator.dupe(u8, source);
+        errdefer self.allocator.free(r.source);
+        r.partition = try self.allocator.dupe(u8, partition);
+        errdefer self.allocator.free(r.partition);
+        if (module) |m| r.module = try self.allocator.dupe(u8, m);
+        errdefer if (r.module) |m| self.allocator.free(m);
+        try self.records.append(r);
+    }
+
+    pub fn add_unit(self: *MountLog, path: []const u8, digest: u64) !void {
+        const copy = try self.allocator.dupe(u8, path);
+        errdefer self.allocator.free(copy);
+        try self.units.append(.{ .path = copy, .digest = digest });
+    }
+
+    /// The unit at `path`; the units have to be sorted.
+    pub fn find_unit(self: *const MountLog, path: []const u8) ?*const Unit {
+        const units = self.units.items;
+        var lo: usize = 0;
+        var hi: usize = units.len;
+        while (lo < hi) {
+            const mid = lo + (hi - lo) / 2;
+            switch (PathIndex.path_order(units[mid].path, path)) {
+                .lt => lo = mid + 1,
+                .gt => hi = mid,
+                .eq => return &units[mid],
+            }
+        }
+        return null;
+    }
+
+    /// Index range of the records at or below `path`; the records have to
+    /// be sorted, which makes them one run.
+    pub fn covered(self: *const MountLog, path: []const u8) Span {
+        const records = self.records.items;
+        var lo: usize = 0;
+        var hi: usize = records.len;
+        while (lo < hi) {
+            const mid = lo + (hi - lo) / 2;
+            if (PathIndex.path_order(records[mid].path, path) == .lt) lo = mid + 1 else hi = mid;
+        }
+        var end = lo;
+        while (end < records.len and PathIndex.covers(path, records[end].path)) end += 1;
+        return .{ .lo = lo, .hi = end };
+    }
+
+    pub fn mark(self: *const MountLog) Mark {
+        return .{ .records = self.records.items.len, .units = self.units.items.len };
+    }
+
+    /// Drops everything added since `m`.
+    pub fn rollback(self: *MountLog, m: Mark) void {
+        for (self.records.items[m.records..]) |r| self.free_record(r);
+        self.records.shrinkRetainingCapacity(m.records);
+        for (self.units.items[m.units..]) |u| self.allocator.free(u.path);
+        self.units.shrinkRetainingCapacity(m.units);
+    }
+
+    /// Moves all records and units of `other` into this log.
+    pub fn absorb(self: *MountLog, other: *MountLog) !void {
+        try self.records.ensureUnusedCapacity(other.records.items.len);
+        try self.units.ensureUnusedCapacity(other.units.items.len);
+        self.records.appendSliceAssumeCapacity(other.records.items);
+        other.records.clearRetainingCapacity();
+        self.units.appendSliceAssumeCapacity(other.units.items);
+        other.units.clearRetainingCapacity();
+    }
+
+    pub fn sort(self: *MountLog) void {
+        std.sort.pdq(Record, self.records.items, {}, record_less);
+        std.sort.pdq(Unit, self.units.items, {}, unit_less);
+    }
+
+    fn record_less(_: void, a: Record, b: Record) bool {
+        return PathIndex.path_order(a.path, b.path) == .lt;
+    }
+
+    fn unit_less(_: void, a: Unit, b: Unit) bool {
+        return PathIndex.path_order(a.path, b.path) == .lt;
+    }
+
+    /// Writes the records and units to `path`, one tab-separated line each,
+    /// under a header carrying the fingerprint and run id. With `append` an
+    /// existing file keeps its header and gets the lines added (the second
+    /// stage of a two-stage run).
+    pub fn save(self: *const MountLog, path: []const u8, append: bool) !void {
+        const file = try std.fs.cwd().createFile(path, .{ .truncate = !append, .mode = 0o600 });
+        defer file.close();
+
+        var bw = std.io.bufferedWriter(file.writer());
+        const w = bw.writer();
+        const end = try file.getEndPos();
+        if (end == 0) {
+            try w.print(SAVE_HEADER ++ "{x:0>16} {x:0>16}\n", .{ self.fingerprint, self.run_id });
+        } else {
+            try file.seekTo(end);
+        }
+        for (self.records.items) |r| {
+            try w.print("{s}\t", .{@tagName(r.kind)});
+            try write_escaped(w, r.path);
+            try w.writeByte('\t');
+            try write_escaped(w, r.source);
+            try w.writeByte('\t');
+            try write_escaped(w, r.module orelse "");
+            try w.writeByte('\t');
+            try write_escaped(w, r.partition);
+            try w.writeByte('\n');
+        }
+        for (self.units.items) |u| {
+            try w.writeAll("unit\t");
+            try write_escaped(w, u.path);
+            try w.print("\t{x:0>16}\n", .{u.digest});
+        }
+        try bw.flush();
+    }
+
+    /// Reads a file written by save().
+    pub fn load(allocator: Allocator, path: []const u8) !MountLog {
+        const data = try std.fs.cwd().readFileAlloc(allocator, path, 64 * 1024 * 1024);
+        defer allocator.free(data);
+
+        var lines = std.mem.splitScalar(u8, data, '\n');
+        const header = lines.next() orelse return error.InvalidFormat;
+        if (!std.mem.startsWith(u8, header, SAVE_HEADER)) return error.InvalidFormat;
+        var ids = std.mem.splitScalar(u8, header[SAVE_HEADER.len..], ' ');
+
+        var self = MountLog.init(allocator);
+        errdefer self.deinit();
+        self.fingerprint = std.fmt.parseInt(u64, ids.next() orelse "", 16) catch return error.InvalidFormat;
+        self.run_id = std.fmt.parseInt(u64, ids.next() orelse "", 16) catch return error.InvalidFormat;
+
+        while (lines.next()) |line| {
+            if (line.len == 0) continue;
+            var it = std.mem.splitScalar(u8, line, '\t');
+            if (std.mem.startsWith(u8, line, "unit\t")) {
+                _ = it.next();
+                const upath = unescape(@constCast(it.next() orelse return error.InvalidFormat));
+                const digest = std.fmt.parseInt(u64, it.next() orelse "", 16) catch return error.InvalidFormat;
+                try self.add_unit(upath, digest);
+                continue;
+            }
+
+            var f: [5][]u8 = undefined;
+            for (&f) |*field| field.* = unescape(@constCast(it.next() orelse return error.InvalidFormat));
+
+            const kind = std.meta.stringToEnum(Kind, f[0]) orelse return error.InvalidFormat;
+            try self.add(f[1], f[2], kind, if (f[3].len > 0) f[3] else null, f[4]);
+        }
+        self.sort();
+        return self;
+    }
+
+    /// Logs mounts per partition and per module. With a budget (> 0) that
+    /// was exceeded, the modules are listed as warnings, biggest first.
+    pub fn report(self: *MountLog, budget: i32) void {
+        var parts = Tally.init(self.allocator);
+        defer parts.deinit();
+        var modules = Tally.init(self.allocator);
+        defer modules.deinit();
+
+        for (self.records.items) |r| {
+            parts.add(r.partition);
+            modules.add(r.module orelse "(none)");
+        }
+
+        const total = self.records.items.len;
+        const over = budget > 0 and total > @as(usize, @intCast(budget));
+
+        if (budget > 0) {
+            Utils.LOGI("mounts added: {d} (budget {d})", .{ total, budget });
+        } else {
+            Utils.LOGI("mounts added: {d}", .{total});
+        }
+        for (parts.sorted()) |e| Utils.LOGI("  /{s}: {d}", .{ e.name, e.count });
+        for (modules.sorted()) |e| {
+            if (over) {
+                Utils.LOGW("  module {s}: {d} mounts", .{ e.name, e.count });
+            } else {
+                Utils.LOGD("  module {s}: {d} mounts", .{ e.name, e.count });
+            }
+        }
+    }
+};
+
+// The separators and the escape character, as octal escapes the way
+// mountinfo writes them, so unescape() reads them back.
+fn write_escaped(w: anytype, s: []const u8) !void {
+    for (s) |c| {
+        switch (c) {
+            '\t', '\n', '\\' => try w.print("\\{o:0>3}", .{c}),
+            else => try w.writeByte(c),
+        }
+    }
+}
+
+// Small name -> count table; names point into the records.
+pub const Tally = struct {
+    pub const Entry = struct { name: []const u8, count: usize };
+
+    entries: ArrayList(Entry),
+
+    pub fn init(allocator: Allocator) Tally {
+        return .{ .entries = ArrayList(Entry).init(allocator) };
+    }
+
+    pub fn deinit(self: *Tally) void {
+        self.entries.deinit();
+    }
+
+    pub fn add(self: *Tally, name: []const u8) void {
+        self.add_n(name, 1);
+    }
+
+    pub fn add_n(self: *Tally, name: []const u8, n: usize) void {
+        for (self.entries.items) |*e| {
+            if (std.mem.eql(u8, e.name, name)) {
+                e.count += n;
+                return;
+            }
+        }
+        self.entries.append(.{ .name = name, .count = n }) catch {};
+    }
+
+    /// Biggest first, ties by name.
+    pub fn sorted(self: *Tally) []Entry {
+        std.sort.pdq(Entry, self.entries.items, {}, entry_more);
+        return self.entries.items;
+    }
+
+    fn entry_more(_: void, a: Entry, b: Entry) bool {
+        if (a.count != b.count) return a.count > b.count;
+        return std.mem.lessThan(u8, a.name, b.name);
+    }
+};
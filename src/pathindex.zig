@@ -0,0 +1,343 @@
+const std = @import("std");
+const os = std.os;
+const Allocator = std.mem.Allocator;
+const ArrayList = std.ArrayList;
+
+pub const INDEX_FILE = "paths.idx";
+
+const MAGIC = "MMPI".*;
+// 2: items in path component order
+const VERSION = 2;
+
+// --- Path index ---
+//
+// Every path a run overrides, with the module it comes from, what kind of
+// node it is and how it was put in place, sorted by path. The file is laid
+// out to be mapped and searched as is: a header, a fixed-size item array
+// and a string blob the items point into. `mmd which` binary-searches it
+// without reading more than the pages it touches, so a lookup costs the
+// same with a hundred entries as with a few hundred thousand.
+//
+// Paths are ordered component by component ('/' sorts before any other
+// byte), so every subtree is one contiguous run of items: `mmd tree` lists
+// a directory level by jumping from one child's subtree to the next.
+pub const Kind = enum(u8) { file, symlink, whiteout, dir };
+
+pub const Strategy = enum(u8) {
+    // module file bind-mounted over the real one
+    bind,
+    // small module file copied into a tmpfs dir
+    copy,
+    // symlink recreated in a tmpfs dir
+    symlink,
+    // real entry left out of a tmpfs dir
+    whiteout,
+    // tmpfs dir mounted here, everything below is rebuilt in it
+    tmpfs,
+    // directory rebuilt inside a parent's tmpfs dir
+    dir,
+};
+
+const Header = extern struct {
+    magic: [4]u8,
+    version: u32,
+    count: u32,
+    strings_len: u32,
+};
+
+pub const Item = extern struct {
+    path_off: u32,
+    path_len: u32,
+    module_off: u32,
+    // 0: no module
+    module_len: u32,
+    kind: Kind,
+    strategy: Strategy,
+    _pad: u16 = 0,
+};
+
+// Collected per applier, merged into one and written after the apply.
+// Strings are copied: the tree is freed partition by partition while the
+// apply is still running.
+pub const Builder = struct {
+    items: ArrayList(Item),
+    strings: ArrayList(u8),
+    // consecutive entries nearly always share a module, store it once;
+    // an offset, the blob moves as it grows
+    last_module_off: u32 = 0,
+    last_module_len: u32 = 0,
+
+    pub fn init(allocator: Allocator) Builder {
+        return .{ .items = ArrayList(Item).init(allocator), .strings = ArrayList(u8).init(allocator) };
+    }
+
+    pub fn deinit(self: *Builder) void {
+        self.items.deinit();
+        self.strings.deinit();
+    }
+
+    pub fn add(self: *Builder, path: []const u8, module: ?[]const u8, kind: Kind, strategy: Strategy) !void {
+        const path_off: u32 = @intCast(self.strings.items.len);
+        try self.strings.appendSlice(path);
+        errdefer self.strings.shrinkRetainingCapacity(path_off);
+
+        var module_off: u32 = 0;
+        var module_len: u32 = 0;
+        if (module) |m| {
+            const last = self.strings.items[self.last_module_off..][0..self.last_module_len];
+            if (self.last_module_len == 0 or !std.mem.eql(u8, last, m)) {
+                self.last_module_off = @intCast(self.strings.items.len);
+                self.last_module_len = @intCast(m.len);
+                try self.strings.appendSlice(m);
+            }
+            module_off = self.last_module_off;
+            module_len = @intCast(m.len);
+        }
+
+        try self.items.append(.{
+            .path_off = path_off,
+            .path_len = @intCast(path.len),
+            .module_off = module_off,
+            .module_len = module_len,
+            .kind = kind,
+            .strategy = strategy,
+        });
+    }
+
+    pub const Mark = struct { items: usize = 0, strings: usize = 0 };
+
+    pub fn mark(self: *const Builder) Mark {
+        return .{ .items = self.items.items.len, .strings = self.strings.items.len };
+    }
+
+    /// Drops every entry added since `m`.
+    pub fn rollback(self: *Builder, m: Mark) void {
+        self.items.shrinkRetainingCapacity(m.items);
+        self.strings.shrinkRetainingCapacity(m.strings);
+        if (self.last_module_off >= m.strings) self.last_module_len = 0;
+    }
+
+    /// Moves everything `other` collected into this builder.
+    pub fn absorb(self: *Builder, other: *Builder) !void {
+        const base: u32 = @intCast(self.strings.items.len);
+        try self.items.ensureUnusedCapacity(other.items.items.len);
+        try self.strings.appendSlice(other.strings.items);
+        for (other.items.items) |it| {
+            var moved = it;
+            moved.path_off += base;
+            if (moved.module_len > 0) moved.module_off += base;
+            self.items.appendAssumeCapacity(moved);
+        }
+        other.items.clearRetainingCapacity();
+        other.strings.clearRetainingCapacity();
+        other.last_module_len = 0;
+    }
+
+    /// Copies the entries of `old` at or below any of `under` (all of
+    /// them if null) into this builder.
+    pub fn keep(self: *Builder, old: *const Index, under: ?[]const []const u8) !void {
+        if (under == null) {
+            for (old.items) |*it| try self.add_from(old, it);
+            return;
+        }
+        for (under.?) |prefix| {
+            var i = old.lower_bound(prefix);
+            while (i < old.items.len and covers(prefix, old.path_of(&old.items[i]))) : (i += 1) {
+                try self.add_from(old, &old.items[i]);
+            }
+        }
+    }
+
+    fn add_from(self: *Builder, old: *const Index, it: *const Item) !void {
+        try self.add(old.path_of(it), old.module_of(it), it.kind, it.strategy);
+    }
+
+    pub fn save(self: *Builder, path: []const u8) !void {
+        std.sort.pdq(Item, self.items.items, self.strings.items, item_less);
+
+        var tmp_buf: [std.fs.MAX_PATH_BYTES]u8 = undefined;
+        const tmp_path = try std.fmt.bufPrint(&tmp_buf, "{s}.tmp", .{path});
+        {
+            const file = try std.fs.cwd().createFile(tmp_path, .{ .mode = 0o644 });
+            defer file.close();
+            var bw = std.io.bufferedWriter(file.writer());
+            const w = bw.writer();
+            const header: Header = .{
+                .magic = MAGIC,
+                .version = VERSION,
+                .count = @intCast(self.items.items.len),
+                .strings_len = @intCast(self.strings.items.len),
+            };
+            try w.writeAll(std.mem.asBytes(&header));
+            try w.writeAll(std.mem.sliceAsBytes(self.items.items));
+            try w.writeAll(self.strings.items);
+            try bw.flush();
+        }
+        // readers map the file: swap it, never rewrite it in place
+        try std.fs.cwd().rename(tmp_path, path);
+    }
+
+    fn item_less(strings: []const u8, a: Item, b: Item) bool {
+        return path_order(strings[a.path_off..][0..a.path_len], strings[b.path_off..][0..b.path_len]) == .lt;
+    }
+};
+
+pub const Child = struct {
+    name: []const u8,
+    // the child's own entry; null for a directory modules only pass through
+    item: ?*const Item,
+    // entries in the child's subtree, itself included
+    entries: usize,
+};
+
+pub const Listing = struct { count: usize, more: bool };
+
+pub const Index = struct {
+    map: []align(std.mem.page_size) const u8,
+    items: []const Item,
+    strings: []const u8,
+
+    pub fn open(path: []const u8) !Index {
+        const file = try std.fs.cwd().openFile(path, .{});
+        defer file.close();
+        const size = try file.getEndPos();
+        if (size < @sizeOf(Header)) return error.InvalidFormat;
+
+        const map = try os.mmap(null, size, os.PROT.READ, os.MAP.PRIVATE, file.handle, 0);
+        errdefer os.munmap(map);
+
+        const header: *const Header = @ptrCast(map.ptr);
+        if (!std.mem.eql(u8, &header.magic, &MAGIC) or header.version != VERSION) return error.InvalidFormat;
+        const items_end = @sizeOf(Header) + @as(usize, header.count) * @sizeOf(Item);
+        if (items_end + header.strings_len != size) return error.InvalidFormat;
+
+        const items_ptr: [*]const Item = @ptrCast(@alignCast(map.ptr + @sizeOf(Header)));
+        return .{
+            .map = map,
+            .items = items_ptr[0..header.count],
+            .strings = map[items_end..],
+        };
+    }
+
+    pub fn close(self: *Index) void {
+        os.munmap(self.map);
+    }
+
+    pub fn path_of(self: *const Index, it: *const Item) []const u8 {
+        return self.string(it.path_off, it.path_len);
+    }
+
+    pub fn module_of(self: *const Index, it: *const Item) ?[]const u8 {
+        if (it.module_len == 0) return null;
+        return self.string(it.module_off, it.module_len);
+    }
+
+    // items are not checked up front, that would touch every page; one
+    // pointing past the blob reads as empty
+    fn string(self: *const Index, off: u32, len: u32) []const u8 {
+        if (@as(usize, off) + len > self.strings.len) return "";
+        return self.strings[off..][0..len];
+    }
+
+    // first item whose path does not sort before `path`
+    pub fn lower_bound(self: *const Index, path: []const u8) usize {
+        var lo: usize = 0;
+        var hi: usize = self.items.len;
+        while (lo < hi) {
+            const mid = lo + (hi - lo) / 2;
+            if (path_order(self.path_of(&self.items[mid]), path) == .lt) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    // first item after `path` and everything below it
+    pub fn subtree_end(self: *const Index, path: []const u8) usize {
+        var lo: usize = 0;
+        var hi: usize = self.items.len;
+        while (lo < hi) {
+            const mid = lo + (hi - lo) / 2;
+            const p = self.path_of(&self.items[mid]);
+            if (path_order(p, path) != .gt or covers(path, p)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    pub fn find(self: *const Index, path: []const u8) ?*const Item {
+        const i = self.lower_bound(path);
+        if (i < self.items.len and std.mem.eql(u8, self.path_of(&self.items[i]), path)) return &self.items[i];
+        return null;
+    }
+
+    /// Lists the level below `dir` into `out`, starting after the child
+    /// named `after` if given. Each child is found with one binary search
+    /// past the previous child's subtree, whatever that subtree's size.
+    pub fn children(self: *const Index, dir: []const u8, after: ?[]const u8, out: []Child) !Listing {
+        var i: usize = 0;
+        if (after) |name| {
+            var buf: [std.fs.MAX_PATH_BYTES]u8 = undefined;
+            const sep = if (std.mem.eql(u8, dir, "/")) "" else "/";
+            i = self.subtree_end(try std.fmt.bufPrint(&buf, "{s}{s}{s}", .{ dir, sep, name }));
+        } else {
+            i = self.lower_bound(dir);
+            if (i < self.items.len and std.mem.eql(u8, self.path_of(&self.items[i]), dir)) i += 1;
+        }
+
+        const start = if (std.mem.eql(u8, dir, "/")) 1 else dir.len + 1;
+        var n: usize = 0;
+        while (i < self.items.len) {
+            const p = self.path_of(&self.items[i]);
+            if (p.len <= start or !covers(dir, p)) break;
+            if (n == out.len) return .{ .count = n, .more = true };
+
+            const end = std.mem.indexOfScalarPos(u8, p, start, '/') orelse p.len;
+            const next = self.subtree_end(p[0..end]);
+            out[n] = .{
+                .name = p[start..end],
+                // a child with an entry of its own sorts first in its subtree
+                .item = if (end == p.len) &self.items[i] else null,
+                .entries = next - i,
+            };
+            n += 1;
+            i = next;
+        }
+        return .{ .count = n, .more = false };
+    }
+
+    /// The entry for `path`, or for the closest directory above it: a path
+    /// inside a tmpfs dir that no module touches is still served by it.
+    pub fn covering(self: *const Index, path: []const u8) ?*const Item {
+        var p = path;
+        while (p.len > 1) {
+            if (self.find(p)) |it| return it;
+            const slash = std.mem.lastIndexOfScalar(u8, p, '/') orelse break;
+            p = if (slash == 0) "/" else p[0..slash];
+        }
+        return null;
+    }
+};
+
+pub fn covers(ancestor: []const u8, path: []const u8) bool {
+    if (std.mem.eql(u8, ancestor, "/")) return path.len > 0 and path[0] == '/';
+    if (!std.mem.startsWith(u8, path, ancestor)) return false;
+    return path.len == ancestor.len or path[ancestor.len] == '/';
+}
+
+pub fn path_order(a: []const u8, b: []const u8) std.math.Order {
+    const n = @min(a.len, b.len);
+    for (a[0..n], b[0..n]) |x, y| {
+        if (x != y) return std.math.order(sort_key(x), sort_key(y));
+    }
+    return std.math.order(a.len, b.len);
+}
+
+fn sort_key(c: u8) u16 {
+    return if (c == '/') 0 else @as(u16, c) + 1;
+}
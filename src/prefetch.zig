@@ -0,0 +1,277 @@
+const std = @import("std");
+const os = std.os;
+const linux = os.linux;
+const Allocator = std.mem.Allocator;
+const ArrayList = std.ArrayList;
+
+const Utils = @import("utils.zig");
+
+const PREFETCH_THREADS = 2;
+const GETDENTS_BUF_SIZE = 8192;
+const DIR_OPEN_FLAGS = os.O.RDONLY | os.O.DIRECTORY | os.O.CLOEXEC;
+
+// Module subdirectory -> real directory it overlays. The promoted
+// partitions are reached through /system/<part>, which resolves to /<part>.
+const Root = struct { module: []const u8, real: []const u8 };
+const roots = [_]Root{
+    .{ .module = "system", .real = "/system" },
+    .{ .module = "vendor", .real = "/vendor" },
+    .{ .module = "system_ext", .real = "/system_ext" },
+    .{ .module = "product", .real = "/product" },
+    .{ .module = "odm", .real = "/odm" },
+};
+
+// --- Cache warm-up ---
+//
+// At post-fs-data the dentry and inode caches for /data/adb/modules and the
+// real partitions are cold, and the scanner and applier pay for every miss
+// synchronously. Prefetch starts before the config is even parsed: a couple
+// of threads claim modules one at a time and walk each module tree together
+// with the real directories it overlays, listing both and statx()ing every
+// entry, so the main pipeline later hits warm caches.
+//
+// Workers never log: logging is not set up yet when they start.
+pub const Prefetch = struct {
+    allocator: Allocator,
+    module_dir: []const u8,
+    modules: ArrayList([]u8),
+    threads: ArrayList(std.Thread),
+
+    next: std.atomic.Value(usize) = std.atomic.Value(usize).init(0),
+    cancelled: std.atomic.Value(bool) = std.atomic.Value(bool).init(false),
+    running: std.atomic.Value(usize) = std.atomic.Value(usize).init(0),
+    dirs: std.atomic.Value(u32) = std.atomic.Value(u32).init(0),
+    entries: std.atomic.Value(u32) = std.atomic.Value(u32).init(0),
+
+    started_ns: i128,
+    // set by the last worker to finish
+    finished_ns: std.atomic.Value(i64) = std.atomic.Value(i64).init(0),
+    consumer_ns: i128 = 0,
+
+    /// Lists the module directory and starts the walkers. Returns null if
+    /// there is nothing to warm up; prefetch is best effort.
+    pub fn start(allocator: Allocator, module_dir: []const u8) ?*Prefetch {
+        const self = allocator.create(Prefetch) catch return null;
+        self.* = .{
+            .allocator = allocator,
+            .module_dir = module_dir,
+            .modules = ArrayList([]u8).init(allocator),
+            .threads = ArrayList(std.Thread).init(allocator),
+            .started_ns = std.time.nanoTimestamp(),
+        };
+
+        self.list_modules() catch {};
+        if (self.modules.items.len == 0) {
+            self.destroy();
+            return null;
+        }
+
+        const n = @min(PREFETCH_THREADS, self.modules.items.len);
+        self.threads.ensureTotalCapacity(n) catch {
+            self.destroy();
+            return null;
+        };
+        var i: usize = 0;
+        while (i < n) : (i += 1) {
+            _ = self.running.fetchAdd(1, .acq_rel);
+            const t = std.Thread.spawn(.{}, worker, .{self}) catch {
+                _ = self.running.fetchSub(1, .acq_rel);
+                break;
+            };
+            self.threads.appendAssumeCapacity(t);
+        }
+        if (self.threads.items.len == 0) {
+            self.destroy();
+            return null;
+        }
+        return self;
+    }
+
+    /// Stops the walkers at the next directory boundary.
+    pub fn cancel(self: *Prefetch) void {
+        self.cancelled.store(true, .release);
+    }
+
+    /// Marks the point where the scanner starts needing the caches.
+    pub fn consumer_started(self: *Prefetch) void {
+        self.consumer_ns = std.time.nanoTimestamp();
+    }
+
+    /// Joins the walkers, logs what the warm-up did and frees it.
+    pub fn finish(self: *Prefetch) void {
+        // whatever is left is now raced by the scanner itself
+        self.cancel();
+        for (self.threads.items) |t| t.join();
+
+        const end_ns: i128 = self.finished_ns.load(.acquire);
+        const consumer_ns = if (self.consumer_ns != 0) self.consumer_ns else end_ns;
+        const took_ms = ns_to_ms(end_ns - self.started_ns);
+        // only the part that ran before the scanner started is work the
+        // scanner certainly did not have to do cold
+        const ahead_ms = ns_to_ms(@min(end_ns, consumer_ns) - self.started_ns);
+
+        Utils.LOGI("prefetch: {d} dirs, {d} entries in {d} ms, {d} ms ahead of the scanner{s}", .{
+            self.dirs.load(.monotonic),
+            self.entries.load(.monotonic),
+            took_ms,
+            ahead_ms,
+            if (end_ns > consumer_ns) " (overlapped)" else "",
+        });
+        self.destroy();
+    }
+
+    fn destroy(self: *Prefetch) void {
+        for (self.modules.items) |m| self.allocator.free(m);
+        self.modules.deinit();
+        self.threads.deinit();
+        self.allocator.destroy(self);
+    }
+
+    fn ns_to_ms(ns: i128) i64 {
+        return @intCast(@divTrunc(@max(ns, 0), std.time.ns_per_ms));
+    }
+
+    fn list_modules(self: *Prefetch) !void {
+        var dir = try std.fs.cwd().openDir(self.module_dir, .{ .iterate = true });
+        defer dir.close();
+
+        var iter = dir.iterate();
+        while (try iter.next()) |e| {
+            if (e.kind != .directory) continue;
+            try self.modules.append(try self.allocator.dupe(u8, e.name));
+        }
+    }
+
+    fn worker(self: *Prefetch) void {
+        var walker = Walker.init(self);
+        defer walker.deinit();
+
+        while (!self.cancelled.load(.acquire)) {
+            const i = self.next.fetchAdd(1, .monotonic);
+            if (i >= self.modules.items.len) break;
+            walker.module(self.modules.items[i]);
+        }
+
+        if (self.running.fetchSub(1, .acq_rel) == 1) {
+            self.finished_ns.store(@intCast(std.time.nanoTimestamp()), .release);
+        }
+    }
+};
+
+// Walks one module root and its real counterpart in lockstep, breadth
+// first, keeping pending directories as relative paths rather than open
+// fds so wide trees do not exhaust the fd table.
+const Walker = struct {
+    // a queued directory, relative to the walk root, stored in `pool`
+    const Pending = struct { off: usize, len: usize };
+
+    pf: *Prefetch,
+    pool: ArrayList(u8),
+    queue: ArrayList(Pending),
+    buf: [GETDENTS_BUF_SIZE]u8 align(@alignOf(linux.dirent64)) = undefined,
+
+    fn init(pf: *Prefetch) Walker {
+        return .{
+            .pf = pf,
+            .pool = ArrayList(u8).init(pf.allocator),
+            .queue = ArrayList(Pending).init(pf.allocator),
+        };
+    }
+
+    fn deinit(self: *Walker) void {
+        self.pool.deinit();
+        self.queue.deinit();
+    }
+
+    fn module(self: *Walker, name: []const u8) void {
+        var path = Utils.PathBuf.init(self.pf.module_dir) catch return;
+        _ = path.push(name) catch return;
+        const base = path.len;
+
+        for (roots) |r| {
+            path.pop(base);
+            _ = path.push(r.module) catch continue;
+
+            const mod_fd = os.open(path.slice(), DIR_OPEN_FLAGS, 0) catch continue;
+            defer os.close(mod_fd);
+            const real_fd: ?os.fd_t = os.open(r.real, DIR_OPEN_FLAGS, 0) catch null;
+            defer if (real_fd) |fd| os.close(fd);
+
+            self.walk(mod_fd, real_fd);
+        }
+    }
+
+    fn walk(self: *Walker, mod_root: os.fd_t, real_root: ?os.fd_t) void {
+        self.pool.clearRetainingCapacity();
+        self.queue.clearRetainingCapacity();
+        self.queue.append(.{ .off = 0, .len = 0 }) catch return;
+
+        var head: usize = 0;
+        while (head < self.queue.items.len) : (head += 1) {
+            if (self.pf.cancelled.load(.acquire)) return;
+
+            const q = self.queue.items[head];
+            var rel = Utils.PathBuf.init(self.pool.items[q.off..][0..q.len]) catch continue;
+            const dot: [:0]const u8 = if (q.len == 0) "." else rel.slice();
+
+            const mod_fd = os.openat(mod_root, dot, DIR_OPEN_FLAGS, 0) catch continue;
+            defer os.close(mod_fd);
+            const real_fd: ?os.fd_t = if (real_root) |r| os.openat(r, dot, DIR_OPEN_FLAGS, 0) catch null else null;
+            defer if (real_fd) |fd| os.close(fd);
+
+            _ = self.pf.dirs.fetchAdd(1, .monotonic);
+            // the applier reads every real directory it touches in full
+            if (real_fd) |fd| self.drain(fd);
+
+            self.scan(mod_fd, real_fd, rel.slice());
+        }
+    }
+
+    // List `mod_fd`, statx each entry and its real counterpart, queue the
+    // subdirectories.
+    fn scan(self: *Walker, mod_fd: os.fd_t, real_fd: ?os.fd_t, rel: []const u8) void {
+        var stx: linux.Statx = undefined;
+        while (true) {
+            const rc = linux.getdents64(mod_fd, &self.buf, self.buf.len);
+            if (linux.getErrno(rc) != .SUCCESS or rc == 0) return;
+
+            var off: usize = 0;
+            while (off < rc) {
+                const d: *align(1) linux.dirent64 = @ptrCast(&self.buf[off]);
+                off += d.reclen;
+
+                const name = std.mem.sliceTo(@as([*:0]u8, @ptrCast(&d.name)), 0);
+                if (std.mem.eql(u8, name, ".") or std.mem.eql(u8, name, "..")) continue;
+                _ = self.pf.entries.fetchAdd(1, .monotonic);
+
+                const zname: [*:0]const u8 = @ptrCast(&d.name);
+                _ = linux.statx(mod_fd, zname, linux.AT.SYMLINK_NOFOLLOW, linux.STATX_BASIC_STATS, &stx);
+                if (real_fd) |fd| {
+                    _ = linux.statx(fd, zname, linux.AT.SYMLINK_NOFOLLOW, linux.STATX_BASIC_STATS, &stx);
+                }
+
+                if (d.type != linux.DT.DIR) continue;
+                self.enqueue(rel, name) catch {};
+            }
+        }
+    }
+
+    fn enqueue(self: *Walker, rel: []const u8, name: []const u8) !void {
+        const at = self.pool.items.len;
+        errdefer self.pool.shrinkRetainingCapacity(at);
+        if (rel.len > 0) {
+            try self.pool.appendSlice(rel);
+            try self.pool.append('/');
+        }
+        try self.pool.appendSlice(name);
+        try self.queue.append(.{ .off = at, .len = self.pool.items.len - at });
+    }
+
+    // Read a directory to the end only to pull its dentries into the cache.
+    fn drain(self: *Walker, fd: os.fd_t) void {
+        while (true) {
+            const rc = linux.getdents64(fd, &self.buf, self.buf.len);
+            if (linux.getErrno(rc) != .SUCCESS or rc == 0) return;
+        }
+    }
+};
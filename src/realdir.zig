@@ -0,0 +1,208 @@
+const std = @import("std");
+const os = std.os;
+const linux = os.linux;
+const Allocator = std.mem.Allocator;
+const ArrayList = std.ArrayList;
+
+const ModuleTree = @import("module_tree.zig");
+const Utils = @import("utils.zig");
+
+const GETDENTS_BUF_SIZE = 8192;
+
+pub const Kind = enum(u8) {
+    unknown,
+    regular,
+    directory,
+    symlink,
+    whiteout,
+    other,
+};
+
+pub const Entry = struct {
+    name_off: u32,
+    name_len: u16,
+    kind: Kind,
+    ino: u64,
+};
+
+// --- Real directory listing ---
+//
+// A real partition directory is read exactly once, with raw getdents64, into
+// a name pool plus a name-sorted entry array. The need-tmpfs check, the child
+// matching and the mirroring of untouched entries all work off this listing;
+// the directory fd stays open so anything that still needs metadata uses
+// fstatat/openat/readlinkat relative to it instead of a fresh path walk.
+pub const RealDir = struct {
+    allocator: Allocator,
+    fd: os.fd_t,
+    names: ArrayList(u8),
+    entries: ArrayList(Entry),
+
+    pub fn open(allocator: Allocator, path: []const u8) !RealDir {
+        const fd = try os.open(path, os.O.RDONLY | os.O.DIRECTORY | os.O.CLOEXEC, 0);
+        return from_fd(allocator, fd);
+    }
+
+    pub fn openat(allocator: Allocator, dir_fd: os.fd_t, name: []const u8) !RealDir {
+        const fd = try os.openat(dir_fd, name, os.O.RDONLY | os.O.DIRECTORY | os.O.NOFOLLOW | os.O.CLOEXEC, 0);
+        return from_fd(allocator, fd);
+    }
+
+    // Takes ownership of `fd`.
+    fn from_fd(allocator: Allocator, fd: os.fd_t) !RealDir {
+        var self: RealDir = .{
+            .allocator = allocator,
+            .fd = fd,
+            .names = ArrayList(u8).init(allocator),
+            .entries = ArrayList(Entry).init(allocator),
+        };
+        errdefer self.deinit();
+        try self.read_all();
+        return self;
+    }
+
+    pub fn deinit(self: *RealDir) void {
+        self.names.deinit();
+        self.entries.deinit();
+        os.close(self.fd);
+    }
+
+    fn read_all(self: *RealDir) !void {
+        var buf: [GETDENTS_BUF_SIZE]u8 align(@alignOf(linux.dirent64)) = undefined;
+
+        while (true) {
+            const rc = linux.getdents64(self.fd, &buf, buf.len);
+            switch (linux.getErrno(rc)) {
+                .SUCCESS => {},
+                else => |err| return os.unexpectedErrno(err),
+            }
+            if (rc == 0) break;
+
+            var off: usize = 0;
+            while (off < rc) {
+                const d: *align(1) linux.dirent64 = @ptrCast(&buf[off]);
+                off += d.reclen;
+
+                const name = std.mem.sliceTo(@as([*:0]u8, @ptrCast(&d.name)), 0);
+                if (std.mem.eql(u8, name, ".") or std.mem.eql(u8, name, "..")) continue;
+
+                try self.entries.append(.{
+                    .name_off = @intCast(self.names.items.len),
+                    .name_len = @intCast(name.len),
+                    .kind = kind_from_dtype(d.type),
+                    .ino = d.ino,
+                });
+                try self.names.appendSlice(name);
+            }
+        }
+
+        std.sort.pdq(Entry, self.entries.items, self, entry_less);
+    }
+
+    fn kind_from_dtype(t: u8) Kind {
+        return switch (t) {
+            linux.DT.REG => .regular,
+            linux.DT.DIR => .directory,
+            linux.DT.LNK => .symlink,
+            // a char device is only a whiteout if rdev == 0, resolved lazily
+            linux.DT.CHR, linux.DT.UNKNOWN => .unknown,
+            else => .other,
+        };
+    }
+
+    fn entry_less(self: *const RealDir, a: Entry, b: Entry) bool {
+        return std.mem.lessThan(u8, self.name_of(a), self.name_of(b));
+    }
+
+    pub fn name_of(self: *const RealDir, e: Entry) []const u8 {
+        return self.names.items[e.name_off..][0..e.name_len];
+    }
+
+    pub fn find(self: *RealDir, name: []const u8) ?*Entry {
+        var lo: usize = 0;
+        var hi: usize = self.entries.items.len;
+        while (lo < hi) {
+            const mid = lo + (hi - lo) / 2;
+            const e = &self.entries.items[mid];
+            switch (std.mem.order(u8, self.name_of(e.*), name)) {
+                .eq => return e,
+                .lt => lo = mid + 1,
+                .gt => hi = mid,
+            }
+        }
+        return null;
+    }
+
+    pub fn stat(self: *RealDir, e: *const Entry) !os.Stat {
+        return os.fstatat(self.fd, self.name_of(e.*), linux.AT.SYMLINK_NOFOLLOW);
+    }
+
+    /// Kind of `e`, falling back to one fstatat when d_type was not enough.
+    pub fn kind(self: *RealDir, e: *Entry) Kind {
+        if (e.kind != .unknown) return e.kind;
+        const st = self.stat(e) catch return .other;
+        e.kind = if (os.S.ISREG(st.mode))
+            .regular
+        else if (os.S.ISDIR(st.mode))
+            .directory
+        else if (os.S.ISLNK(st.mode))
+            .symlink
+        else if (os.S.ISCHR(st.mode) and st.rdev == 0)
+            .whiteout
+        else
+            .other;
+        return e.kind;
+    }
+
+    /// Same mapping as ModuleTree.node_type_from_stat.
+    pub fn node_type(self: *RealDir, e: *Entry) ModuleTree.NodeFileType {
+        return switch (self.kind(e)) {
+            .regular => .REGULAR,
+            .directory => .DIRECTORY,
+            .symlink => .SYMLINK,
+            .whiteout, .other, .unknown => .WHITEOUT,
+        };
+    }
+};
+
+// --- Chain resolution ---
+const OpenHow = extern struct {
+    flags: u64,
+    mode: u64,
+    resolve: u64,
+};
+
+const RESOLVE_NO_SYMLINKS: u64 = 0x04;
+const RESOLVE_BENEATH: u64 = 0x08;
+
+/// True if the multi-component path `rel` resolves below `dir_fd` to a
+/// directory without passing through a symlink or non-directory, i.e. a
+/// compressed chain needs no tmpfs at any of its levels. One openat2 when
+/// the kernel has it (5.6+), otherwise one fstatat per component.
+pub fn chain_is_plain(dir_fd: os.fd_t, rel: []const u8) bool {
+    var path = Utils.PathBuf.init(rel) catch return false;
+
+    var how: OpenHow = .{
+        .flags = os.O.PATH | os.O.DIRECTORY | os.O.CLOEXEC,
+        .mode = 0,
+        .resolve = RESOLVE_NO_SYMLINKS | RESOLVE_BENEATH,
+    };
+    const rc = linux.syscall4(.openat2, @bitCast(@as(isize, dir_fd)), @intFromPtr(path.slice().ptr), @intFromPtr(&how), @sizeOf(OpenHow));
+    switch (linux.getErrno(rc)) {
+        .SUCCESS => {
+            os.close(@intCast(rc));
+            return true;
+        },
+        .NOSYS => {},
+        else => return false,
+    }
+
+    var end: usize = 0;
+    while (end < rel.len) {
+        end = std.mem.indexOfScalarPos(u8, rel, end + 1, '/') orelse rel.len;
+        path.set(rel[0..end]) catch return false;
+        const st = os.fstatat(dir_fd, path.slice(), linux.AT.SYMLINK_NOFOLLOW) catch return false;
+        if (!os.S.ISDIR(st.mode)) return false;
+    }
+    return true;
+}
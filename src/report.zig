@@ -0,0 +1,213 @@
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const ArrayList = std.ArrayList;
+
+const MagicMountMod = @import("magic_mount.zig");
+const MagicMount = MagicMountMod.MagicMount;
+const Utils = @import("utils.zig");
+const Backend = @import("backend.zig");
+const MountLog = @import("mountlog.zig").MountLog;
+const Status = @import("status.zig");
+
+pub const REPORT_FILE = "report.json";
+// the background stage of a two-stage run reports on its own
+pub const DEFERRED_REPORT_FILE = "report.deferred.json";
+pub const SCHEMA_VERSION = 1;
+
+// --- Run report ---
+//
+// What print_summary logs, for tools: the configuration the run actually
+// used, how long each phase took, every counter, each failure with its
+// reason, and mounts and failures per partition. Written by magic_mount()
+// once it is done, next to the status snapshot, whole or not at all.
+
+// Wall time per phase, in microseconds. The scan is streamed into the
+// apply, so the two are one phase.
+pub const Phases = struct {
+    // fingerprint, rerun check, incremental baseline
+    prepare: i64 = 0,
+    // workdir, scan and apply
+    apply: i64 = 0,
+    verify: i64 = 0,
+    // record file and path index
+    record: i64 = 0,
+    // try-umount registration
+    umount: i64 = 0,
+    // workdir shrink and detach
+    cleanup: i64 = 0,
+    total: i64 = 0,
+};
+
+pub const Lap = struct {
+    started: i128,
+    last: i128,
+
+    pub fn start() Lap {
+        const now = std.time.nanoTimestamp();
+        return .{ .started = now, .last = now };
+    }
+
+    /// Microseconds since the previous lap.
+    pub fn lap(self: *Lap) i64 {
+        const now = std.time.nanoTimestamp();
+        defer self.last = now;
+        return @intCast(@divTrunc(now - self.last, std.time.ns_per_us));
+    }
+
+    pub fn total(self: *const Lap) i64 {
+        return @intCast(@divTrunc(std.time.nanoTimestamp() - self.started, std.time.ns_per_us));
+    }
+};
+
+// One failed node; strings are owned by whoever holds the list.
+pub const Failure = struct {
+    path: []u8,
+    module: ?[]u8,
+    reason: []const u8,
+};
+
+pub fn free_failure(allocator: Allocator, f: Failure) void {
+    allocator.free(f.path);
+    if (f.module) |m| allocator.free(m);
+}
+
+const PartitionResult = struct {
+    name: []u8,
+    mounts: usize = 0,
+    failures: usize = 0,
+};
+
+pub const Run = struct {
+    allocator: Allocator,
+    phases: Phases = .{},
+    failures: ArrayList(Failure),
+    partitions: ArrayList(PartitionResult),
+    mounts_added: usize = 0,
+
+    pub fn init(allocator: Allocator) Run {
+        return .{
+            .allocator = allocator,
+            .failures = ArrayList(Failure).init(allocator),
+            .partitions = ArrayList(PartitionResult).init(allocator),
+        };
+    }
+
+    pub fn deinit(self: *Run) void {
+        for (self.failures.items) |f| free_failure(self.allocator, f);
+        self.failures.deinit();
+        for (self.partitions.items) |p| self.allocator.free(p.name);
+        self.partitions.deinit();
+    }
+
+    fn partition(self: *Run, name: []const u8) ?*PartitionResult {
+        for (self.partitions.items) |*p| {
+            if (std.mem.eql(u8, p.name, name)) return p;
+        }
+        const copy = self.allocator.dupe(u8, name) catch return null;
+        self.partitions.append(.{ .name = copy }) catch {
+            self.allocator.free(copy);
+            return null;
+        };
+        return &self.partitions.items[self.partitions.items.len - 1];
+    }
+
+    /// Counts what `log` added, per partition.
+    pub fn count_mounts(self: *Run, log: *const MountLog) void {
+        self.mounts_added = log.records.items.len;
+        for (log.records.items) |r| {
+            if (self.partition(r.partition)) |p| p.mounts += 1;
+        }
+    }
+
+    pub fn write(self: *Run, tmp_root: []const u8, ctx: *const MagicMount, rc: i32) !void {
+        // a failure belongs to the partition its path starts in
+        for (self.failures.items) |f| {
+            var it = std.mem.tokenizeScalar(u8, f.path, '/');
+            const first = it.next() orelse continue;
+            if (self.partition(first)) |p| p.failures += 1;
+        }
+
+        const stage: MagicMountMod.ApplyStage = @enumFromInt(ctx.apply_stage);
+        const name = if (stage == .deferred) DEFERRED_REPORT_FILE else REPORT_FILE;
+        var path_buf: [Utils.PATH_MAX]u8 = undefined;
+        const path = try Utils.path_join(self.allocator, &path_buf, tmp_root, name);
+        var tmp_buf: [Utils.PATH_MAX]u8 = undefined;
+        const tmp_path = try std.fmt.bufPrint(&tmp_buf, "{s}.tmp", .{path});
+
+        {
+            const file = try std.fs.cwd().createFile(tmp_path, .{ .mode = 0o644 });
+            defer file.close();
+            var bw = std.io.bufferedWriter(file.writer());
+            try self.write_json(bw.writer(), tmp_root, ctx, stage, rc);
+            try bw.flush();
+        }
+        try std.fs.cwd().rename(tmp_path, path);
+    }
+
+    fn write_json(self: *Run, w: anytype, tmp_root: []const u8, ctx: *const MagicMount, stage: MagicMountMod.ApplyStage, rc: i32) !void {
+        try w.print("{{\"schema\":{d},\"time\":{d},\"rc\":{d},\"stage\":\"{s}\",", .{ SCHEMA_VERSION, std.time.timestamp(), rc, @tagName(stage) });
+        try w.print("\"fingerprint\":\"{x:0>16}\",\"run_id\":\"{x:0>16}\",", .{ ctx.fingerprint, ctx.run_id });
+
+        try w.writeAll("\"config\":{\"module_dir\":");
+        try Status.write_json_string(w, std.mem.sliceTo(ctx.module_dir, 0));
+        try w.writeAll(",\"mount_source\":");
+        try Status.write_json_string(w, std.mem.sliceTo(ctx.mount_source, 0));
+        try w.writeAll(",\"temp_dir\":");
+        try Status.write_json_string(w, tmp_root);
+        try w.print(",\"backend\":\"{s}\",\"threads\":{d},\"inline_copy_kb\":{d},\"max_mounts\":{d},\"umount\":{},\"verify\":{},\"incremental\":{}", .{
+            Backend.get().name(), ctx.apply_threads, ctx.inline_copy_kb, ctx.max_mounts, ctx.enable_unmountable, ctx.verify, ctx.incremental,
+        });
+        try w.writeAll(",\"extra_partitions\":");
+        try write_names(w, ctx.extra_parts);
+        try w.writeAll(",\"partition_order\":");
+        try write_names(w, ctx.partition_order);
+        try w.writeAll(",\"critical_partitions\":");
+        try write_names(w, ctx.critical_parts);
+        try w.writeAll("},");
+
+        try w.writeAll("\"phases_us\":{");
+        inline for (std.meta.fields(Phases), 0..) |f, i| {
+            if (i > 0) try w.writeByte(',');
+            try w.print("\"{s}\":{d}", .{ f.name, @field(self.phases, f.name) });
+        }
+        try w.writeAll("},");
+
+        try w.writeAll("\"counters\":");
+        try Status.write_stats(w, &ctx.stats);
+
+        try w.print(",\"mounts\":{{\"added\":{d},\"budget\":{d}}}", .{ self.mounts_added, ctx.max_mounts });
+
+        try w.writeAll(",\"partitions\":[");
+        for (self.partitions.items, 0..) |p, i| {
+            if (i > 0) try w.writeByte(',');
+            try w.writeAll("{\"name\":");
+            try Status.write_json_string(w, p.name);
+            try w.print(",\"mounts\":{d},\"failures\":{d}}}", .{ p.mounts, p.failures });
+        }
+
+        try w.writeAll("],\"failures\":[");
+        for (self.failures.items, 0..) |f, i| {
+            if (i > 0) try w.writeByte(',');
+            try w.writeAll("{\"path\":");
+            try Status.write_json_string(w, f.path);
+            try w.writeAll(",\"module\":");
+            if (f.module) |m| try Status.write_json_string(w, m) else try w.writeAll("null");
+            try w.print(",\"reason\":\"{s}\"}}", .{f.reason});
+        }
+
+        try w.writeAll("],\"failed_modules\":");
+        try write_names(w, ctx.failed_modules);
+        try w.writeAll("}\n");
+    }
+};
+
+fn write_names(w: anytype, list: anytype) !void {
+    try w.writeByte('[');
+    if (list) |l| {
+        for (l.items, 0..) |name, i| {
+            if (i > 0) try w.writeByte(',');
+            try Status.write_json_string(w, name);
+        }
+    }
+    try w.writeByte(']');
+}
@@ -0,0 +1,157 @@
+const std = @import("std");
+const os = std.os;
+const linux = os.linux;
+const Allocator = std.mem.Allocator;
+const ArrayList = std.ArrayList;
+
+const Utils = @import("utils.zig");
+
+// Contexts longer than this fall back to the size-probing path in Utils.
+const SELCON_BUF_SIZE = 256;
+
+pub const Inherit = enum { unknown, yes, no };
+
+// Type transitions are per class, so inheritance is probed per class.
+pub const Class = enum { file, dir, symlink };
+
+// Whether a new `class` object under a tmpfs dir labelled `parent` keeps
+// that label; `parent` is an interned label, compared by pointer.
+const Probe = struct {
+    parent: [*]const u8,
+    class: Class,
+    inherit: bool,
+};
+
+// --- SELinux context cache ---
+//
+// Every mirrored entry needs its label copied, but a directory's entries
+// almost always share a handful of contexts. Labels are read with a single
+// fixed-buffer getxattr and interned, so equal labels are equal pointers and
+// the common "child has the same label as its tmpfs parent" case can skip
+// the setxattr entirely. Policy type transitions are keyed by parent type
+// and object class, so that is only done once the first object of the same
+// class under a dir with the same label was seen to inherit it.
+pub const SelconCache = struct {
+    allocator: Allocator,
+    labels: ArrayList([]u8),
+    probes: ArrayList(Probe),
+
+    reads: u32 = 0,
+    relabels: u32 = 0,
+    relabels_skipped: u32 = 0,
+
+    pub fn init(allocator: Allocator) SelconCache {
+        return .{
+            .allocator = allocator,
+            .labels = ArrayList([]u8).init(allocator),
+            .probes = ArrayList(Probe).init(allocator),
+        };
+    }
+
+    pub fn deinit(self: *SelconCache) void {
+        for (self.labels.items) |l| self.allocator.free(l);
+        self.labels.deinit();
+        self.probes.deinit();
+    }
+
+    /// Whether a new `class` object under a dir labelled `parent_con`
+    /// (interned) is known to inherit that label.
+    pub fn inherits(self: *const SelconCache, parent_con: ?[]const u8, class: Class) Inherit {
+        const pc = parent_con orelse return .no;
+        for (self.probes.items) |p| {
+            if (p.parent == pc.ptr and p.class == class) return if (p.inherit) .yes else .no;
+        }
+        return .unknown;
+    }
+
+    /// Returns the interned copy of `con`.
+    pub fn intern(self: *SelconCache, con: []const u8) ![]const u8 {
+        // newest first: siblings tend to repeat the label just seen
+        var i = self.labels.items.len;
+        while (i > 0) {
+            i -= 1;
+            const l = self.labels.items[i];
+            if (std.mem.eql(u8, l, con)) return l;
+        }
+        const copy = try self.allocator.dupe(u8, con);
+        errdefer self.allocator.free(copy);
+        try self.labels.append(copy);
+        return copy;
+    }
+
+    fn strip(buf: []const u8) []const u8 {
+        // the kernel may include the trailing NUL in the value
+        return if (buf.len > 0 and buf[buf.len - 1] == 0) buf[0 .. buf.len - 1] else buf;
+    }
+
+    pub fn read_fd(self: *SelconCache, fd: os.fd_t) ![]const u8 {
+        var buf: [SELCON_BUF_SIZE]u8 = undefined;
+        self.reads += 1;
+        const len = linux.fgetxattr(fd, Utils.SELINUX_XATTR, &buf, buf.len) catch |err| {
+            if (err != error.RANGE) return err;
+            // not expected for real policies, keep it correct anyway
+            return self.read_fd_slow(fd);
+        };
+        return self.intern(strip(buf[0..len]));
+    }
+
+    pub fn read_path(self: *SelconCache, path: []const u8) ![]const u8 {
+        var buf: [SELCON_BUF_SIZE]u8 = undefined;
+        self.reads += 1;
+        const len = linux.lgetxattr(path, Utils.SELINUX_XATTR, &buf, buf.len) catch |err| {
+            if (err != error.RANGE) return err;
+            return self.read_slow(path);
+        };
+        return self.intern(strip(buf[0..len]));
+    }
+
+    // Through the fd itself: an l*xattr call on /proc/self/fd/N would read
+    // the label of the magic link, not of the file.
+    fn read_fd_slow(self: *SelconCache, fd: os.fd_t) ![]const u8 {
+        const size = try linux.fgetxattr(fd, Utils.SELINUX_XATTR, null, 0);
+        const buf = try self.allocator.alloc(u8, size);
+        defer self.allocator.free(buf);
+        const len = try linux.fgetxattr(fd, Utils.SELINUX_XATTR, buf.ptr, buf.len);
+        return self.intern(strip(buf[0..len]));
+    }
+
+    fn read_slow(self: *SelconCache, path: []const u8) ![]const u8 {
+        const con = try Utils.get_selcon(self.allocator, path);
+        defer self.allocator.free(con);
+        return self.intern(strip(con));
+    }
+
+    /// Labels a freshly created tmpfs entry of `class` with `con`.
+    /// `parent_con` is the label we gave its parent directory, or null if
+    /// unknown. `fd` is used when available, otherwise `path` is labelled
+    /// without following links.
+    pub fn apply(self: *SelconCache, fd: ?os.fd_t, path: []const u8, class: Class, con: []const u8, parent_con: ?[]const u8) !void {
+        const same_as_parent = if (parent_con) |pc| pc.ptr == con.ptr else false;
+
+        if (same_as_parent) switch (self.inherits(parent_con, class)) {
+            .yes => {
+                self.relabels_skipped += 1;
+                return;
+            },
+            .no => {},
+            .unknown => {
+                // check once per parent label and class whether it is inherited
+                const actual = (if (fd) |f| self.read_fd(f) else self.read_path(path)) catch null;
+                const inherit = if (actual) |a| a.ptr == con.ptr else false;
+                self.probes.append(.{ .parent = con.ptr, .class = class, .inherit = inherit }) catch {};
+                Utils.LOGD("selcon: new {s} under {s} inherits its label: {}", .{ @tagName(class), con, inherit });
+                if (inherit) {
+                    self.relabels_skipped += 1;
+                    return;
+                }
+            },
+        };
+
+        self.relabels += 1;
+        if (fd) |f| {
+            try Utils.set_selcon_fd(f, con);
+        } else {
+            try Utils.set_selcon(path, con);
+        }
+    }
+};
@@ -0,0 +1,131 @@
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+const MagicMountMod = @import("magic_mount.zig");
+const MagicMount = MagicMountMod.MagicMount;
+const MountStats = MagicMountMod.MountStats;
+const Utils = @import("utils.zig");
+const MountLogMod = @import("mountlog.zig");
+const MountLog = MountLogMod.MountLog;
+const Tally = MountLogMod.Tally;
+
+pub const STATUS_FILE = "status.json";
+pub const SCHEMA_VERSION = 1;
+
+// --- Status snapshot ---
+//
+// One small JSON file next to the record file, rewritten (write + rename)
+// after every run: the run's stats, per-module results and the mounts now
+// in place. Readers (`mmd status`, the WebUI, dashboards) get a consistent
+// snapshot with a single read and never wait on a running apply. The
+// mounts come from the record file, so a two-stage run or a kept previous
+// run shows everything in place, not just what the last stage added.
+pub fn write(allocator: Allocator, tmp_root: []const u8, ctx: *const MagicMount, rc: i32) !void {
+    var records_buf: [Utils.PATH_MAX]u8 = undefined;
+    const records_path = try Utils.path_join(allocator, &records_buf, tmp_root, MagicMountMod.RECORDS_FILE);
+    var log = MountLog.load(allocator, records_path) catch MountLog.init(allocator);
+    defer log.deinit();
+
+    var path_buf: [Utils.PATH_MAX]u8 = undefined;
+    const path = try Utils.path_join(allocator, &path_buf, tmp_root, STATUS_FILE);
+    var tmp_buf: [Utils.PATH_MAX]u8 = undefined;
+    const tmp_path = try std.fmt.bufPrint(&tmp_buf, "{s}.tmp", .{path});
+
+    {
+        const file = try std.fs.cwd().createFile(tmp_path, .{ .mode = 0o644 });
+        defer file.close();
+        var bw = std.io.bufferedWriter(file.writer());
+        try write_snapshot(bw.writer(), allocator, ctx, rc, &log);
+        try bw.flush();
+    }
+    try std.fs.cwd().rename(tmp_path, path);
+}
+
+fn write_snapshot(w: anytype, allocator: Allocator, ctx: *const MagicMount, rc: i32, log: *const MountLog) !void {
+    const stage: MagicMountMod.ApplyStage = @enumFromInt(ctx.apply_stage);
+    try w.print("{{\"version\":{d},\"time\":{d},\"rc\":{d},\"stage\":\"{s}\",", .{ SCHEMA_VERSION, std.time.timestamp(), rc, @tagName(stage) });
+    try w.print("\"fingerprint\":\"{x:0>16}\",\"run_id\":\"{x:0>16}\",", .{ log.fingerprint, log.run_id });
+
+    try w.writeAll("\"stats\":");
+    try write_stats(w, &ctx.stats);
+    try w.writeByte(',');
+
+    // modules with mounts in place, then failed ones that have none
+    var modules = Tally.init(allocator);
+    defer modules.deinit();
+    for (log.records.items) |r| modules.add(r.module orelse "(none)");
+    const failed: []const []u8 = if (ctx.failed_modules) |arr| arr.items else &.{};
+
+    try w.writeAll("\"modules\":[");
+    var first = true;
+    for (modules.sorted()) |e| {
+        if (!first) try w.writeByte(',');
+        first = false;
+        try w.writeAll("{\"name\":");
+        try write_json_string(w, e.name);
+        try w.print(",\"mounts\":{d},\"failed\":{}}}", .{ e.count, name_in(failed, e.name) });
+    }
+    for (failed) |name| {
+        if (tally_has(&modules, name)) continue;
+        if (!first) try w.writeByte(',');
+        first = false;
+        try w.writeAll("{\"name\":");
+        try write_json_string(w, name);
+        try w.writeAll(",\"mounts\":0,\"failed\":true}");
+    }
+    try w.writeAll("],");
+
+    try w.writeAll("\"mounts\":[");
+    for (log.records.items, 0..) |r, i| {
+        if (i > 0) try w.writeByte(',');
+        try w.writeAll("{\"path\":");
+        try write_json_string(w, r.path);
+        try w.print(",\"kind\":\"{s}\",\"module\":", .{@tagName(r.kind)});
+        if (r.module) |m| try write_json_string(w, m) else try w.writeAll("null");
+        try w.writeAll(",\"partition\":");
+        try write_json_string(w, r.partition);
+        try w.writeByte('}');
+    }
+    try w.writeAll("]}\n");
+}
+
+/// MountStats as one JSON object, field names as keys.
+pub fn write_stats(w: anytype, stats: *const MountStats) !void {
+    try w.writeByte('{');
+    inline for (std.meta.fields(MountStats), 0..) |f, i| {
+        if (i > 0) try w.writeByte(',');
+        try w.print("\"{s}\":{d}", .{ f.name, @field(stats, f.name) });
+    }
+    try w.writeByte('}');
+}
+
+fn name_in(list: []const []const u8, name: []const u8) bool {
+    for (list) |n| {
+        if (std.mem.eql(u8, n, name)) return true;
+    }
+    return false;
+}
+
+fn tally_has(t: *const Tally, name: []const u8) bool {
+    for (t.entries.items) |e| {
+        if (std.mem.eql(u8, e.name, name)) return true;
+    }
+    return false;
+}
+
+/// Writes `s` as a JSON string. Paths are bytes, not UTF-8: anything
+/// outside printable ASCII is escaped as \u00XX, one byte per escape.
+pub fn write_json_string(w: anytype, s: []const u8) !void {
+    try w.writeByte('"');
+    for (s) |c| {
+        switch (c) {
+            '"' => try w.writeAll("\\\""),
+            '\\' => try w.writeAll("\\\\"),
+            '\n' => try w.writeAll("\\n"),
+            '\t' => try w.writeAll("\\t"),
+            0x20...0x21, 0x23...0x5b, 0x5d...0x7e => try w.writeByte(c),
+            else => try w.print("\\u{x:0>4}", .{c}),
+        }
+    }
+    try w.writeByte('"');
+}
@@ -137,6 +137,54 @@ pub fn path_join(allocator: Allocator, buf: *[PATH_MAX]u8, base: []const u8, nam
     return buf[0..offset];
 }
 
+// Incremental path builder for tree walks: push() appends one component and
+// returns a mark, pop(mark) truncates back to it. The buffer is always
+// NUL-terminated, so slice() can be handed straight to syscalls.
+pub const PathBuf = struct {
+    buf: [PATH_MAX]u8 = undefined,
+    len: usize = 0,
+
+    pub fn init(base: []const u8) !PathBuf {
+        var self: PathBuf = .{};
+        try self.set(base);
+        return self;
+    }
+
+    pub fn set(self: *PathBuf, base: []const u8) !void {
+        if (base.len >= PATH_MAX) return error.NameTooLong;
+        @memcpy(self.buf[0..base.len], base);
+        self.len = base.len;
+        self.buf[self.len] = 0;
+    }
+
+    pub fn push(self: *PathBuf, name: []const u8) !usize {
+        const mark = self.len;
+        if (name.len == 0) return mark;
+
+        const use_slash = self.len == 0 or self.buf[self.len - 1] != '/';
+        const needed = self.len + @intFromBool(use_slash) + name.len + 1;
+        if (needed > PATH_MAX) return error.NameTooLong;
+
+        if (use_slash) {
+            self.buf[self.len] = '/';
+            self.len += 1;
+        }
+        @memcpy(self.buf[self.len..][0..name.len], name);
+        self.len += name.len;
+        self.buf[self.len] = 0;
+        return mark;
+    }
+
+    pub fn pop(self: *PathBuf, mark: usize) void {
+        self.len = mark;
+        self.buf[self.len] = 0;
+    }
+
+    pub fn slice(self: *const PathBuf) [:0]const u8 {
+        return self.buf[0..self.len :0];
+    }
+};
+
 pub fn path_exists(path: []const u8) bool {
     return os.stat(path) catch return false;
 }
@@ -228,6 +276,35 @@ pub fn str_is_true(str: []const u8) bool {
            std.mem.eql(u8, lower, "on");
 }
 
+// --- File copy ---
+// Copies `len` bytes from `src` to `dst` (both at their current offsets)
+// in the kernel: copy_file_range, or sendfile where the kernel refuses a
+// cross-filesystem copy_file_range (before 5.3).
+pub fn copy_fd(dst: os.fd_t, src: os.fd_t, len: u64) !void {
+    var left = len;
+    var use_cfr = true;
+    while (left > 0) {
+        const chunk: usize = @intCast(@min(left, 1 << 30));
+        const rc = if (use_cfr)
+            linux.copy_file_range(src, null, dst, null, chunk, 0)
+        else
+            linux.sendfile(dst, src, null, chunk);
+        switch (linux.getErrno(rc)) {
+            .SUCCESS => {},
+            .XDEV, .NOSYS, .INVAL, .OPNOTSUPP => {
+                if (!use_cfr) return error.CopyFailed;
+                use_cfr = false;
+                continue;
+            },
+            .INTR => continue,
+            else => |err| return os.unexpectedErrno(err),
+        }
+        // file shrank under us
+        if (rc == 0) return error.CopyFailed;
+        left -= rc;
+    }
+}
+
 // --- SELinux xattr ---
 pub fn set_selcon(path: []const u8, con: []const u8) !void {
     if (path.len == 0 or con.len == 0) {
@@ -278,6 +355,11 @@ pub fn copy_selcon(allocator: Allocator, src: []const u8, dst: []const u8) !void
     try set_selcon(dst, con);
 }
 
+pub fn set_selcon_fd(fd: os.fd_t, con: []const u8) !void {
+    if (con.len == 0) return;
+    try linux.fsetxattr(fd, SELINUX_XATTR, con, 0);
+}
+
 // --- Permission check ---
 pub fn root_check() !void {
     if (os.geteuid() != 0) {
@@ -0,0 +1,125 @@
+const std = @import("std");
+const os = std.os;
+const linux = os.linux;
+const Allocator = std.mem.Allocator;
+
+const Utils = @import("utils.zig");
+const MountInfo = @import("mountinfo.zig").MountInfo;
+const Entry = @import("mountinfo.zig").Entry;
+const Record = @import("mountlog.zig").Record;
+
+// records per thread below which another thread is not worth spawning
+const RECORDS_PER_THREAD = 64;
+const MAX_THREADS = 8;
+
+// Set on every tmpfs dir a run moves into place, holding the run id, so a
+// later run can tell its own tmpfs mounts from anyone else's with the same
+// source.
+pub const RUN_MARK_XATTR = "trusted.magic_mount";
+
+pub const Result = struct {
+    checked: usize = 0,
+    failed: usize = 0,
+};
+
+// --- Post-apply verification ---
+//
+// Checks every mount the run recorded against a fresh mountinfo snapshot
+// and the live filesystem: the mount point must be there and visible, a
+// bind must be read-only and show the module file's dev/ino, a moved tmpfs
+// must be a read-only tmpfs from our mount source and, given a run mark,
+// carry it. A mirror only has to be there: it keeps the flags of the mount
+// it was bound from, and its source is the path the tmpfs now covers.
+// The statx calls dominate, so records are checked on a few threads.
+const Checker = struct {
+    mi: *const MountInfo,
+    records: []const Record,
+    mark: ?[]const u8,
+    next: std.atomic.Value(usize) = std.atomic.Value(usize).init(0),
+    failed: std.atomic.Value(usize) = std.atomic.Value(usize).init(0),
+
+    fn worker(self: *Checker) void {
+        while (true) {
+            const i = self.next.fetchAdd(1, .monotonic);
+            if (i >= self.records.len) break;
+            const r = &self.records[i];
+            if (check(self.mi, r, self.mark)) |why| {
+                _ = self.failed.fetchAdd(1, .monotonic);
+                Utils.LOGE("verify {s} ({s} from {s}): {s}", .{ r.path, @tagName(r.kind), r.module orelse "-", why });
+            }
+        }
+    }
+};
+
+pub fn run(allocator: Allocator, records: []const Record, mark: ?[]const u8, max_threads: usize) !Result {
+    if (records.len == 0) return .{};
+
+    var mi = try MountInfo.load(allocator);
+    defer mi.deinit();
+
+    var checker: Checker = .{ .mi = &mi, .records = records, .mark = mark };
+
+    const want = @min(@max(max_threads, 1), MAX_THREADS, records.len / RECORDS_PER_THREAD + 1);
+    var threads: [MAX_THREADS]std.Thread = undefined;
+    var spawned: usize = 0;
+    while (spawned + 1 < want) : (spawned += 1) {
+        threads[spawned] = std.Thread.spawn(.{}, Checker.worker, .{&checker}) catch break;
+    }
+    // the calling thread takes a share too
+    checker.worker();
+    for (threads[0..spawned]) |t| t.join();
+
+    return .{ .checked = records.len, .failed = checker.failed.load(.monotonic) };
+}
+
+/// Returns why `r` is not in place, or null if it is.
+pub fn check(mi: *const MountInfo, r: *const Record, mark: ?[]const u8) ?[]const u8 {
+    if (identify(mi, r, mark)) |why| return why;
+    const e = mi.find(r.path).?;
+    if (r.kind != .mirror and !e.read_only()) return "not read-only";
+    return null;
+}
+
+/// Like check(), but only asks whether the visible mount on the path is
+/// the one `r` describes, whatever its flags.
+pub fn identify(mi: *const MountInfo, r: *const Record, mark: ?[]const u8) ?[]const u8 {
+    const e = mi.find(r.path) orelse return "not mounted";
+
+    var buf: [Utils.PATH_MAX]u8 = undefined;
+    const at = stat_path(&buf, r.path) orelse return "stat failed";
+    // something mounted later (or a parent moved over it) hides our mount
+    if (at.dev_major != e.major or at.dev_minor != e.minor) return "shadowed";
+
+    switch (r.kind) {
+        // the real file is hidden below the tmpfs; a mirror that is
+        // mounted and not shadowed is the one we made
+        .mirror => {},
+        .bind => {
+            const src = stat_path(&buf, r.source) orelse return "source stat failed";
+            if (src.dev_major != at.dev_major or src.dev_minor != at.dev_minor or src.ino != at.ino) {
+                return "wrong source";
+            }
+        },
+        .tmpfs => {
+            if (!std.mem.eql(u8, e.fstype, "tmpfs")) return "not a tmpfs";
+            if (!std.mem.eql(u8, e.source, r.source)) return "wrong source";
+            if (mark) |m| {
+                var val: [64]u8 = undefined;
+                const len = linux.lgetxattr(buf[0..r.path.len :0], RUN_MARK_XATTR, &val, val.len) catch return "no run mark";
+                if (!std.mem.eql(u8, val[0..len], m)) return "other run";
+            }
+        },
+    }
+    return null;
+}
+
+fn stat_path(buf: *[Utils.PATH_MAX]u8, path: []const u8) ?linux.Statx {
+    if (path.len >= buf.len) return null;
+    @memcpy(buf[0..path.len], path);
+    buf[path.len] = 0;
+
+    var stx: linux.Statx = undefined;
+    const rc = linux.statx(linux.AT.FDCWD, buf[0..path.len :0], linux.AT.SYMLINK_NOFOLLOW, linux.STATX_BASIC_STATS, &stx);
+    if (linux.getErrno(rc) != .SUCCESS) return null;
+    return stx;
+}
@@ -0,0 +1,96 @@
+const std = @import("std");
+const os = std.os;
+const linux = os.linux;
+const Allocator = std.mem.Allocator;
+
+const Utils = @import("utils.zig");
+
+// a change settles once the module dir has been quiet this long
+pub const DEBOUNCE_MS = 500;
+// ... or at the latest this long after the first event of a burst
+pub const MAX_DELAY_MS = 5000;
+
+const EVENT_BUF_SIZE = 16 * 1024;
+
+// module dir: modules appearing, going away or being renamed
+const ROOT_MASK = linux.IN.CREATE | linux.IN.DELETE | linux.IN.MOVED_FROM | linux.IN.MOVED_TO | linux.IN.ONLYDIR;
+// each module: the disable/remove/skip_mount markers and its partition
+// dirs coming and going, plus a file written in place
+const MODULE_MASK = ROOT_MASK | linux.IN.CLOSE_WRITE | linux.IN.ATTRIB;
+
+// --- Module watcher ---
+//
+// inotify on the module dir and on the top level of every module in it:
+// enough to see installs, removals and toggles, which all show up there.
+// Watches live in the kernel and are re-synced after every pass instead of
+// being tracked here (adding a watch twice returns the same descriptor, a
+// deleted dir drops its own), so the watcher holds nothing but its fd and
+// a fixed event buffer however long it runs.
+pub const Watcher = struct {
+    fd: i32,
+    module_dir: []const u8,
+    buf: [EVENT_BUF_SIZE]u8 align(@alignOf(linux.inotify_event)) = undefined,
+
+    pub fn init(module_dir: []const u8) !Watcher {
+        const fd = try os.inotify_init1(linux.IN.CLOEXEC | linux.IN.NONBLOCK);
+        var self: Watcher = .{ .fd = fd, .module_dir = module_dir };
+        errdefer os.close(fd);
+        try self.sync();
+        return self;
+    }
+
+    pub fn deinit(self: *Watcher) void {
+        os.close(self.fd);
+    }
+
+    /// Watches the module dir and every module currently in it.
+    pub fn sync(self: *Watcher) !void {
+        _ = try os.inotify_add_watch(self.fd, self.module_dir, ROOT_MASK);
+
+        var dir = try std.fs.cwd().openDir(self.module_dir, .{ .iterate = true });
+        defer dir.close();
+        var path = try Utils.PathBuf.init(self.module_dir);
+        var it = dir.iterate();
+        while (try it.next()) |entry| {
+            if (entry.kind != .directory) continue;
+            const mark = path.push(entry.name) catch continue;
+            defer path.pop(mark);
+            _ = os.inotify_add_watch(self.fd, path.slice(), MODULE_MASK) catch |err| {
+                Utils.LOGW("watch {s}: {s}", .{ path.slice(), @errorName(err) });
+            };
+        }
+    }
+
+    /// Blocks until something changed, then until the burst is over.
+    /// Returns the number of events seen.
+    pub fn wait(self: *Watcher) !usize {
+        var fds = [_]os.pollfd{.{ .fd = self.fd, .events = os.POLL.IN, .revents = 0 }};
+        _ = try os.poll(&fds, -1);
+
+        var events = self.drain();
+        const first = std.time.milliTimestamp();
+        while (std.time.milliTimestamp() - first < MAX_DELAY_MS) {
+            fds[0].revents = 0;
+            if (try os.poll(&fds, DEBOUNCE_MS) == 0) break;
+            events += self.drain();
+        }
+        return events;
+    }
+
+    fn drain(self: *Watcher) usize {
+        var events: usize = 0;
+        while (true) {
+            const n = os.read(self.fd, &self.buf) catch break;
+            if (n == 0) break;
+            var off: usize = 0;
+            while (off + @sizeOf(linux.inotify_event) <= n) {
+                const ev: *const linux.inotify_event = @ptrCast(@alignCast(&self.buf[off]));
+                if (ev.getName()) |name| Utils.LOGD("watch: {s} (0x{x})", .{ name, ev.mask });
+                if (ev.mask & linux.IN.Q_OVERFLOW != 0) Utils.LOGW("watch: event queue overflowed", .{});
+                events += 1;
+                off += @sizeOf(linux.inotify_event) + ev.len;
+            }
+        }
+        return events;
+    }
+};
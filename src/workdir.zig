@@ -0,0 +1,189 @@
+const std = @import("std");
+const os = std.os;
+const linux = os.linux;
+const Allocator = std.mem.Allocator;
+
+const Utils = @import("utils.zig");
+const SelconCache = @import("selcon.zig").SelconCache;
+
+const DIR_OPEN_FLAGS = os.O.RDONLY | os.O.DIRECTORY | os.O.NOFOLLOW | os.O.CLOEXEC;
+
+// --- Fd-relative workdir ---
+//
+// Keeps one open dirfd per directory created inside the workdir tmpfs, keyed
+// by its path relative to the workdir root. Creating a file or directory
+// therefore never re-walks the prefix: the parent fd is looked up once and
+// everything else is *at()/f*() on that fd.
+//
+// Each known directory also remembers the SELinux label we gave it, so
+// children that share it can skip relabelling (see SelconCache.apply).
+//
+// All fds must be released with deinit() before the workdir is unmounted,
+// otherwise they pin the detached tmpfs.
+pub const WorkDir = struct {
+    const Entry = struct {
+        fd: os.fd_t,
+        con: ?[]const u8 = null,
+    };
+
+    allocator: Allocator,
+    root: []const u8,
+    root_entry: Entry,
+    known: std.StringHashMap(Entry),
+    selcon: SelconCache,
+
+    pub fn init(allocator: Allocator, root: []const u8) !WorkDir {
+        const fd = try os.open(root, DIR_OPEN_FLAGS, 0);
+        var self: WorkDir = .{
+            .allocator = allocator,
+            .root = root,
+            .root_entry = .{ .fd = fd },
+            .known = std.StringHashMap(Entry).init(allocator),
+            .selcon = SelconCache.init(allocator),
+        };
+        self.root_entry.con = self.selcon.read_fd(fd) catch null;
+        return self;
+    }
+
+    pub fn deinit(self: *WorkDir) void {
+        var it = self.known.iterator();
+        while (it.next()) |e| {
+            os.close(e.value_ptr.fd);
+            self.allocator.free(e.key_ptr.*);
+        }
+        self.known.deinit();
+        os.close(self.root_entry.fd);
+        self.selcon.deinit();
+    }
+
+    // Path of `wpath` below the workdir root ("" for the root itself).
+    fn relative(self: *const WorkDir, wpath: []const u8) ?[]const u8 {
+        if (!std.mem.startsWith(u8, wpath, self.root)) return null;
+        var rel = wpath[self.root.len..];
+        if (rel.len > 0 and rel[0] != '/') return null;
+        while (rel.len > 0 and rel[0] == '/') rel = rel[1..];
+        while (rel.len > 0 and rel[rel.len - 1] == '/') rel = rel[0 .. rel.len - 1];
+        return rel;
+    }
+
+    fn lookup(self: *WorkDir, rel: []const u8) ?*Entry {
+        if (rel.len == 0) return &self.root_entry;
+        return self.known.getPtr(rel);
+    }
+
+    // Open (creating if needed) the directory `rel`, whose parent is `parent`.
+    // Invalidates previously returned *Entry pointers.
+    fn create(self: *WorkDir, parent: *Entry, rel: []const u8, mode: os.mode_t) !*Entry {
+        const name = if (std.mem.lastIndexOfScalar(u8, rel, '/')) |s| rel[s + 1 ..] else rel;
+
+        os.mkdirat(parent.fd, name, mode) catch |err| {
+            if (err != error.PathAlreadyExists) {
+                Utils.LOGE("mkdirat {s}/{s}: {s}", .{ self.root, rel, @errorName(err) });
+                return err;
+            }
+        };
+
+        // until relabelled, a new tmpfs dir carries whatever it inherited
+        const con = if (self.selcon.inherits(parent.con, .dir) == .yes) parent.con else null;
+
+        const fd = try os.openat(parent.fd, name, DIR_OPEN_FLAGS, 0);
+        errdefer os.close(fd);
+
+        const key = try self.allocator.dupe(u8, rel);
+        errdefer self.allocator.free(key);
+        const gop = try self.known.getOrPut(key);
+        gop.value_ptr.* = .{ .fd = fd, .con = con };
+        return gop.value_ptr;
+    }
+
+    fn entry(self: *WorkDir, wpath: []const u8) !*Entry {
+        const rel = self.relative(wpath) orelse return error.NotInWorkdir;
+        if (self.lookup(rel)) |e| return e;
+
+        // Walk up to the deepest directory we already hold an fd for ...
+        var known_len: usize = rel.len;
+        var parent: *Entry = &self.root_entry;
+        while (std.mem.lastIndexOfScalar(u8, rel[0..known_len], '/')) |s| {
+            known_len = s;
+            if (self.lookup(rel[0..known_len])) |e| {
+                parent = e;
+                break;
+            }
+        } else {
+            known_len = 0;
+        }
+
+        // ... then create downwards from there.
+        var pos = if (known_len == 0) 0 else known_len + 1;
+        while (true) {
+            const end = std.mem.indexOfScalarPos(u8, rel, pos, '/') orelse rel.len;
+            parent = try self.create(parent, rel[0..end], 0o755);
+            if (end == rel.len) return parent;
+            pos = end + 1;
+        }
+    }
+
+    /// Returns the dirfd of work directory `wpath`, creating it and any
+    /// missing parents. Already known directories cost a single hash lookup.
+    pub fn dir(self: *WorkDir, wpath: []const u8) !os.fd_t {
+        return (try self.entry(wpath)).fd;
+    }
+
+    /// Returns the parent directory of `wpath` and the final component.
+    pub fn parent(self: *WorkDir, wpath: []const u8) !struct { dir: *Entry, name: []const u8 } {
+        const slash = std.mem.lastIndexOfScalar(u8, wpath, '/') orelse return error.InvalidArgument;
+        const e = try self.entry(wpath[0..slash]);
+        return .{ .dir = e, .name = wpath[slash + 1 ..] };
+    }
+
+    /// Creates an empty placeholder file to bind mount over.
+    pub fn file(self: *WorkDir, wpath: []const u8, mode: os.mode_t) !void {
+        const p = try self.parent(wpath);
+        const fd = try os.openat(p.dir.fd, p.name, os.O.WRONLY | os.O.CREAT | os.O.NOFOLLOW | os.O.CLOEXEC, mode);
+        os.close(fd);
+    }
+
+    /// Creates `wpath` as a copy of the `size` bytes readable from `src`,
+    /// with the mode, owner and label (`con`, if known) of the original.
+    pub fn copy(self: *WorkDir, src: os.fd_t, wpath: []const u8, st: os.Stat, con: ?[]const u8) !void {
+        const p = try self.parent(wpath);
+        const parent_con = p.dir.con;
+        const fd = try os.openat(p.dir.fd, p.name, os.O.WRONLY | os.O.CREAT | os.O.EXCL | os.O.NOFOLLOW | os.O.CLOEXEC, 0o600);
+        defer os.close(fd);
+        errdefer os.unlinkat(p.dir.fd, p.name, 0) catch {};
+
+        try Utils.copy_fd(fd, src, @intCast(st.size));
+        os.fchmod(fd, st.mode & 0o7777) catch {};
+        os.fchown(fd, st.uid, st.gid) catch {};
+        if (con) |c| self.selcon.apply(fd, wpath, .file, c, parent_con) catch |err| {
+            Utils.LOGW("setcon {s}: {s}", .{ wpath, @errorName(err) });
+        };
+    }
+
+    /// Creates symlink `wpath` and labels it with `con` when given.
+    pub fn symlink(self: *WorkDir, target: []const u8, wpath: []const u8, con: ?[]const u8) !void {
+        const p = try self.parent(wpath);
+        try os.symlinkat(target, p.dir.fd, p.name);
+        if (con) |c| self.selcon.apply(null, wpath, .symlink, c, p.dir.con) catch |err| {
+            Utils.LOGW("setcon {s}: {s}", .{ wpath, @errorName(err) });
+        };
+    }
+
+    /// Creates directory `wpath` and applies mode, owner and label `con`
+    /// (if known) through its fd.
+    pub fn mkdir_meta(self: *WorkDir, wpath: []const u8, st: os.Stat, con: ?[]const u8) !os.fd_t {
+        const p = try self.parent(wpath);
+        const parent_con = p.dir.con;
+        const e = try self.entry(wpath);
+        os.fchmod(e.fd, st.mode & 0o7777) catch {};
+        os.fchown(e.fd, st.uid, st.gid) catch {};
+        if (con) |c| {
+            self.selcon.apply(e.fd, wpath, .dir, c, parent_con) catch |err| {
+                Utils.LOGW("setcon {s}: {s}", .{ wpath, @errorName(err) });
+                return e.fd;
+            };
+            e.con = c;
+        }
+        return e.fd;
+    }
+};
@@ -3,6 +3,9 @@
 # meta-mm metamount.sh
 ############################################
 
+# mmd reads mm.conf, rotates its own log and reports the module-mounted
+# event to KernelSU itself, so nothing else is spawned on the boot path.
+# Set notify=false in mm.conf to leave the notification to someone else.
 MODDIR="${0%/*}"
 
 # Binary path (architecture-specific binary selected during installation)
@@ -13,32 +16,10 @@ if [ ! -f "$BINARY" ]; then
     exit 1
 fi
 
-MM_LOG_FILE=$(busybox awk -F= '
-/^[[:space:]]*log_file[[:space:]]*=/ {
-    val=$2
-    sub(/#.*/, "", val)
-    gsub(/^[ \t"]+|[ \t"]+$/, "", val)
-    print val
-}' /data/adb/magic_mount/mm.conf)
-
-if [ -f "$MM_LOG_FILE" ]; then
-    mv "$MM_LOG_FILE" "$MM_LOG_FILE".old
-fi
-
-# Set environment variables
-export MODULE_METADATA_DIR="/data/adb/modules"
-
-log "Metadata directory: $MODULE_METADATA_DIR"
-log "Executing $BINARY"
-
-$BINARY
+MODULE_METADATA_DIR="/data/adb/modules" "$BINARY"
 
 EXIT_CODE=$?
-
-if [ "$EXIT_CODE" = 0 ]; then
-    /data/adb/ksud kernel notify-module-mounted
-    log "Mount completed successfully"
-else
+if [ "$EXIT_CODE" != 0 ]; then
     log "Mount failed with exit code $EXIT_CODE"
 fi
 
@@ -2,6 +2,9 @@
 
 import { useState, useEffect } from 'react'
 import ConfigView from '@/components/ConfigView'
+import StatusPanel from '@/components/StatusPanel'
+import TreeExplorer from '@/components/TreeExplorer'
+import LogViewer from '@/components/LogViewer'
 
 export default function Home() {
   const [theme, setTheme] = useState('system')
@@ -89,6 +92,15 @@ export default function Home() {
             </p>
           </div>
 
+          {/* 运行状态 */}
+          <StatusPanel />
+
+          {/* 挂载树 */}
+          <TreeExplorer />
+
+          {/* 日志 */}
+          <LogViewer />
+
           {/* 功能特性 */}
           <div className="grid grid-cols-1 md:grid-cols-2 gap-6 w-full max-w-2xl">
             <div className="p-6 rounded-lg bg-gray-50 dark:bg-gray-800 border border-gray-200 dark:border-gray-700">
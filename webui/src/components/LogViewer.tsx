@@ -0,0 +1,119 @@
+'use client'
+
+import { useState, useEffect, useRef } from 'react'
+import { getLog } from '@/lib/mmd'
+
+// 每次只读取上次位置之后的新内容
+const POLL_MS = 2000
+// 页面中最多保留的行数，更早的行丢弃
+const MAX_LINES = 2000
+// 模块过滤输入停顿这么久后才重新读取
+const FILTER_DELAY_MS = 300
+
+const LEVELS = [
+  { value: 'debug', label: '全部' },
+  { value: 'info', label: '信息及以上' },
+  { value: 'warn', label: '警告及以上' },
+  { value: 'error', label: '仅错误' },
+]
+
+function lineColor(line: string): string {
+  if (line.startsWith('[ERROR]')) return 'text-red-500'
+  if (line.startsWith('[WARN]')) return 'text-yellow-600 dark:text-yellow-400'
+  if (line.startsWith('[DEBUG]')) return 'text-gray-400 dark:text-gray-500'
+  return 'text-gray-800 dark:text-gray-200'
+}
+
+export default function LogViewer() {
+  const [level, setLevel] = useState('info')
+  const [module, setModule] = useState('')
+  const [filter, setFilter] = useState('')
+  const [lines, setLines] = useState<string[]>([])
+  const [error, setError] = useState<string | null>(null)
+  const [follow, setFollow] = useState(true)
+  const next = useRef<number | null>(null)
+  const viewRef = useRef<HTMLDivElement>(null)
+
+  // 不必每敲一个字都调用一次 mmd log
+  useEffect(() => {
+    const t = setTimeout(() => setFilter(module.trim()), FILTER_DELAY_MS)
+    return () => clearTimeout(t)
+  }, [module])
+
+  // 过滤条件变化后从末尾重新开始
+  useEffect(() => {
+    next.current = null
+    setLines([])
+    let cancelled = false
+    let timer: ReturnType<typeof setTimeout>
+
+    const poll = async () => {
+      try {
+        const chunk = await getLog(next.current, { level, module: filter || undefined })
+        if (cancelled) return
+        next.current = chunk.next
+        setLines(prev => {
+          const base = chunk.rotated ? [] : prev
+          const merged = chunk.lines.length > 0 ? [...base, ...chunk.lines] : base
+          return merged.length > MAX_LINES ? merged.slice(merged.length - MAX_LINES) : merged
+        })
+        setError(null)
+        // 一次没读完时立刻继续，否则等下一轮
+        timer = setTimeout(poll, chunk.next < chunk.size ? 0 : POLL_MS)
+      } catch (e) {
+        if (cancelled) return
+        setError(e instanceof Error ? e.message : String(e))
+        timer = setTimeout(poll, POLL_MS)
+      }
+    }
+    poll()
+
+    return () => {
+      cancelled = true
+      clearTimeout(timer)
+    }
+  }, [level, filter])
+
+  useEffect(() => {
+    if (follow && viewRef.current) viewRef.current.scrollTop = viewRef.current.scrollHeight
+  }, [lines, follow])
+
+  return (
+    <section className="w-full max-w-2xl p-6 rounded-lg bg-gray-50 dark:bg-gray-800 border border-gray-200 dark:border-gray-700">
+      <h2 className="text-lg font-semibold text-gray-900 dark:text-white mb-3">日志</h2>
+
+      <div className="flex flex-wrap items-center gap-3 mb-3 text-sm">
+        <select
+          value={level}
+          onChange={e => setLevel(e.target.value)}
+          className="px-2 py-1 border border-gray-300 dark:border-gray-600 rounded-md bg-white dark:bg-gray-700 text-gray-900 dark:text-white"
+        >
+          {LEVELS.map(l => (
+            <option key={l.value} value={l.value}>{l.label}</option>
+          ))}
+        </select>
+        <input
+          value={module}
+          onChange={e => setModule(e.target.value)}
+          placeholder="按模块过滤"
+          className="flex-1 min-w-0 px-2 py-1 border border-gray-300 dark:border-gray-600 rounded-md bg-white dark:bg-gray-700 text-gray-900 dark:text-white"
+        />
+        <label className="flex items-center gap-1 text-gray-700 dark:text-gray-300">
+          <input type="checkbox" checked={follow} onChange={e => setFollow(e.target.checked)} />
+          自动滚动
+        </label>
+      </div>
+
+      {error && <p className="text-sm text-red-500 mb-2">无法读取日志：{error}</p>}
+
+      <div
+        ref={viewRef}
+        className="h-80 overflow-y-auto rounded-md bg-white dark:bg-gray-900 border border-gray-200 dark:border-gray-700 p-2 font-mono text-xs"
+      >
+        {lines.map((line, i) => (
+          <div key={i} className={`whitespace-pre-wrap break-all ${lineColor(line)}`}>{line}</div>
+        ))}
+      </div>
+    </section>
+  )
+}
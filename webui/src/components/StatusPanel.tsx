@@ -0,0 +1,87 @@
+'use client'
+
+import { useState, useEffect, useCallback } from 'react'
+import { getStatus, Status } from '@/lib/mmd'
+
+// 轮询间隔（毫秒），读取的是一次写好的快照，开销很小
+const POLL_MS = 5000
+
+const STAT_LABELS: [string, string][] = [
+  ['modules_total', '模块数'],
+  ['mounts_added', '挂载数'],
+  ['nodes_mounted', '已挂载节点'],
+  ['nodes_fail', '失败'],
+  ['partitions', '分区'],
+  ['subtrees', '子树'],
+  ['threads_used', '线程'],
+  ['tmpfs_used_kb', 'tmpfs (KiB)'],
+]
+
+export default function StatusPanel() {
+  const [status, setStatus] = useState<Status | null>(null)
+  const [error, setError] = useState<string | null>(null)
+
+  const refresh = useCallback(async () => {
+    try {
+      setStatus(await getStatus())
+      setError(null)
+    } catch (e) {
+      setError(e instanceof Error ? e.message : String(e))
+    }
+  }, [])
+
+  useEffect(() => {
+    refresh()
+    const timer = setInterval(refresh, POLL_MS)
+    return () => clearInterval(timer)
+  }, [refresh])
+
+  return (
+    <section className="w-full max-w-2xl p-6 rounded-lg bg-gray-50 dark:bg-gray-800 border border-gray-200 dark:border-gray-700">
+      <div className="flex items-center justify-between mb-4">
+        <h2 className="text-lg font-semibold text-gray-900 dark:text-white">运行状态</h2>
+        <button
+          onClick={refresh}
+          className="px-3 py-1 text-sm rounded-md bg-gray-100 dark:bg-gray-700 text-gray-700 dark:text-gray-300 hover:bg-gray-200 dark:hover:bg-gray-600 transition-colors"
+        >
+          刷新
+        </button>
+      </div>
+
+      {error && <p className="text-sm text-red-500">无法读取状态：{error}</p>}
+
+      {status && (
+        <div className="space-y-4 text-sm">
+          <p className="text-gray-600 dark:text-gray-400">
+            {status.rc === 0 ? '✅ 上次运行成功' : `❌ 上次运行失败 (rc=${status.rc})`}
+            {' · '}
+            {new Date(status.time * 1000).toLocaleString()}
+            {' · '}
+            阶段 {status.stage}
+          </p>
+
+          <div className="grid grid-cols-2 sm:grid-cols-4 gap-3">
+            {STAT_LABELS.map(([key, label]) => (
+              <div key={key} className="p-3 rounded-md bg-white dark:bg-gray-900 border border-gray-200 dark:border-gray-700">
+                <div className="text-xs text-gray-500 dark:text-gray-400">{label}</div>
+                <div className="text-lg font-semibold text-gray-900 dark:text-white">{status.stats[key] ?? 0}</div>
+              </div>
+            ))}
+          </div>
+
+          <div>
+            <h3 className="font-medium text-gray-900 dark:text-white mb-2">模块</h3>
+            <ul className="divide-y divide-gray-200 dark:divide-gray-700">
+              {status.modules.map(m => (
+                <li key={m.name} className="flex justify-between py-1">
+                  <span className={m.failed ? 'text-red-500' : 'text-gray-700 dark:text-gray-300'}>{m.name}</span>
+                  <span className="text-gray-500 dark:text-gray-400">{m.failed ? '失败' : `${m.mounts} 个挂载`}</span>
+                </li>
+              ))}
+            </ul>
+          </div>
+        </div>
+      )}
+    </section>
+  )
+}
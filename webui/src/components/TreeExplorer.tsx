@@ -0,0 +1,128 @@
+'use client'
+
+import { useState, useEffect, useCallback, useRef } from 'react'
+import { getTreePage, TreeEntry } from '@/lib/mmd'
+
+// 行高固定，只渲染可见范围内的行
+const ROW_HEIGHT = 40
+const VIEW_HEIGHT = 480
+const OVERSCAN = 8
+const PAGE_SIZE = 200
+
+const STRATEGY_LABELS: Record<string, string> = {
+  bind: '绑定挂载',
+  copy: '内联复制',
+  symlink: '符号链接',
+  whiteout: '隐藏',
+  tmpfs: 'tmpfs 目录',
+  dir: 'tmpfs 内目录',
+}
+
+function joinPath(dir: string, name: string): string {
+  return dir === '/' ? `/${name}` : `${dir}/${name}`
+}
+
+export default function TreeExplorer() {
+  const [path, setPath] = useState('/')
+  const [rows, setRows] = useState<TreeEntry[]>([])
+  const [next, setNext] = useState<string | null>(null)
+  const [loading, setLoading] = useState(false)
+  const [error, setError] = useState<string | null>(null)
+  const [scrollTop, setScrollTop] = useState(0)
+  const viewRef = useRef<HTMLDivElement>(null)
+  // 切换目录后丢弃旧目录还在路上的请求
+  const seq = useRef(0)
+
+  const load = useCallback(async (dir: string, after: string | null) => {
+    const mine = ++seq.current
+    setLoading(true)
+    try {
+      const page = await getTreePage(dir, after, PAGE_SIZE)
+      if (mine !== seq.current) return
+      setRows(prev => (after === null ? page.entries : [...prev, ...page.entries]))
+      setNext(page.next)
+      setError(null)
+    } catch (e) {
+      if (mine === seq.current) setError(e instanceof Error ? e.message : String(e))
+    } finally {
+      if (mine === seq.current) setLoading(false)
+    }
+  }, [])
+
+  useEffect(() => {
+    setRows([])
+    setNext(null)
+    setScrollTop(0)
+    if (viewRef.current) viewRef.current.scrollTop = 0
+    load(path, null)
+  }, [path, load])
+
+  const first = Math.max(0, Math.floor(scrollTop / ROW_HEIGHT) - OVERSCAN)
+  const last = Math.min(rows.length, Math.ceil((scrollTop + VIEW_HEIGHT) / ROW_HEIGHT) + OVERSCAN)
+
+  // 接近底部时取下一页
+  useEffect(() => {
+    if (!loading && next !== null && last >= rows.length - OVERSCAN) load(path, next)
+  }, [last, rows.length, next, loading, path, load])
+
+  const crumbs = path === '/' ? [] : path.slice(1).split('/')
+
+  return (
+    <section className="w-full max-w-2xl p-6 rounded-lg bg-gray-50 dark:bg-gray-800 border border-gray-200 dark:border-gray-700">
+      <h2 className="text-lg font-semibold text-gray-900 dark:text-white mb-3">挂载树</h2>
+
+      <nav className="flex flex-wrap items-center gap-1 text-sm mb-3">
+        <button onClick={() => setPath('/')} className="text-blue-500 hover:underline">/</button>
+        {crumbs.map((c, i) => (
+          <span key={i} className="flex items-center gap-1">
+            <button
+              onClick={() => setPath('/' + crumbs.slice(0, i + 1).join('/'))}
+              className="text-blue-500 hover:underline"
+            >
+              {c}
+            </button>
+            {i < crumbs.length - 1 && <span className="text-gray-400">/</span>}
+          </span>
+        ))}
+      </nav>
+
+      {error && <p className="text-sm text-red-500 mb-2">无法读取挂载树：{error}</p>}
+
+      <div
+        ref={viewRef}
+        onScroll={e => setScrollTop(e.currentTarget.scrollTop)}
+        className="overflow-y-auto rounded-md bg-white dark:bg-gray-900 border border-gray-200 dark:border-gray-700"
+        style={{ height: VIEW_HEIGHT }}
+      >
+        <div style={{ height: rows.length * ROW_HEIGHT, position: 'relative' }}>
+          {rows.slice(first, last).map((row, i) => {
+            // entries 包含节点自身（若模块提供了它）
+            const below = row.entries - (row.strategy ? 1 : 0)
+            const canOpen = row.kind === 'dir' && below > 0
+            return (
+              <div
+                key={row.name}
+                onClick={() => canOpen && setPath(joinPath(path, row.name))}
+                className={`absolute left-0 right-0 flex items-center justify-between px-3 text-sm border-b border-gray-100 dark:border-gray-800 ${canOpen ? 'cursor-pointer hover:bg-gray-50 dark:hover:bg-gray-800' : ''}`}
+                style={{ top: (first + i) * ROW_HEIGHT, height: ROW_HEIGHT }}
+              >
+                <span className="truncate text-gray-900 dark:text-white">
+                  {row.kind === 'dir' ? '📁' : row.kind === 'symlink' ? '🔗' : row.kind === 'whiteout' ? '🚫' : '📄'} {row.name}
+                </span>
+                <span className="ml-3 shrink-0 text-xs text-gray-500 dark:text-gray-400">
+                  {row.module ?? ''}
+                  {row.strategy && ` · ${STRATEGY_LABELS[row.strategy] ?? row.strategy}`}
+                  {below > 0 && ` · ${below} 项`}
+                </span>
+              </div>
+            )
+          })}
+        </div>
+      </div>
+
+      <p className="mt-2 text-xs text-gray-500 dark:text-gray-400">
+        {loading ? '加载中…' : `已加载 ${rows.length} 项${next !== null ? '，向下滚动加载更多' : ''}`}
+      </p>
+    </section>
+  )
+}
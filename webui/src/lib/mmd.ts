@@ -0,0 +1,123 @@
+// KernelSU WebUI 注入的 window.ksu，通过它在设备上执行命令
+interface KsuBridge {
+  exec: (cmd: string, options: string, callback: string) => void
+}
+
+declare global {
+  interface Window {
+    ksu?: KsuBridge
+    [key: string]: unknown
+  }
+}
+
+// KernelSU 会把当前 metamodule 链接到这里
+export const MMD = '/data/adb/metamodule/mmd'
+
+export interface ExecResult {
+  errno: number
+  stdout: string
+  stderr: string
+}
+
+let callbackSeq = 0
+
+export function exec(cmd: string): Promise<ExecResult> {
+  return new Promise((resolve, reject) => {
+    const ksu = typeof window !== 'undefined' ? window.ksu : undefined
+    if (!ksu) {
+      reject(new Error('不在 KernelSU WebUI 中运行'))
+      return
+    }
+    const name = `mmd_exec_${Date.now()}_${callbackSeq++}`
+    window[name] = (errno: number, stdout: string, stderr: string) => {
+      delete window[name]
+      resolve({ errno, stdout, stderr })
+    }
+    ksu.exec(cmd, '{}', name)
+  })
+}
+
+// 运行 mmd 子命令并把标准输出解析为 JSON
+export async function mmdJson<T>(args: string): Promise<T> {
+  const res = await exec(`${MMD} ${args}`)
+  if (res.errno !== 0) {
+    throw new Error(res.stderr.trim() || `mmd ${args} 退出码 ${res.errno}`)
+  }
+  return JSON.parse(res.stdout) as T
+}
+
+export interface MountEntry {
+  path: string
+  kind: 'bind' | 'tmpfs' | 'mirror'
+  module: string | null
+  partition: string
+}
+
+export interface ModuleResult {
+  name: string
+  mounts: number
+  failed: boolean
+}
+
+export interface Status {
+  version: number
+  time: number
+  rc: number
+  stage: string
+  fingerprint: string
+  run_id: string
+  stats: Record<string, number>
+  modules: ModuleResult[]
+  mounts: MountEntry[]
+}
+
+export function getStatus(): Promise<Status> {
+  return mmdJson<Status>('status')
+}
+
+// 单引号包裹，供拼接进 shell 命令
+export function shellQuote(s: string): string {
+  return `'${s.replace(/'/g, `'\\''`)}'`
+}
+
+export interface TreeEntry {
+  name: string
+  kind: 'file' | 'symlink' | 'whiteout' | 'dir'
+  strategy: string | null
+  module: string | null
+  entries: number
+}
+
+export interface TreePage {
+  path: string
+  entries: TreeEntry[]
+  next: string | null
+}
+
+// 每次只取一层目录的一页
+export function getTreePage(path: string, after: string | null, limit = 200): Promise<TreePage> {
+  let args = `tree --json --path ${shellQuote(path)} --limit ${limit}`
+  if (after !== null) args += ` --after ${shellQuote(after)}`
+  return mmdJson<TreePage>(args)
+}
+
+export interface LogChunk {
+  offset: number
+  next: number
+  size: number
+  rotated: boolean
+  lines: string[]
+}
+
+export interface LogQuery {
+  level?: string
+  module?: string
+}
+
+// since 为 null 时只取末尾 tail 字节；之后用返回的 next 增量读取
+export function getLog(since: number | null, query: LogQuery, tail = 64 * 1024): Promise<LogChunk> {
+  let args = since === null ? `log --json --tail ${tail}` : `log --json --since ${since}`
+  if (query.level) args += ` --level ${shellQuote(query.level)}`
+  if (query.module) args += ` --module ${shellQuote(query.module)}`
+  return mmdJson<LogChunk>(args)
+}